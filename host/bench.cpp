@@ -0,0 +1,316 @@
+// Microbenchmarks for the firmware hot paths, built for the host against the
+// stub SDK headers. Reports wall time and heap allocations per operation;
+// compare runs before and after a change to catch regressions.
+//
+//   switch_bench [filter]   runs every benchmark whose name contains filter
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "CommandParser.h"
+#include "FastLogger.h"
+#include "MacroAssembler.h"
+#include "MacroStore.h"
+#include "SerialInput.h"
+#include "SwitchBluetooth.h"
+#include "pico/stdio_usb.h"
+
+// Every operator new in the process goes through here
+static size_t allocation_count = 0;
+
+void* operator new(size_t size) {
+    allocation_count++;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+
+static const char* name_filter = nullptr;
+
+// Results go to the original stdout; stdout itself is pointed at /dev/null
+// so flushed log output costs the same as on a quiet serial port
+static FILE* results = nullptr;
+
+// Runs setup (untimed) and body (timed) for the given number of batches;
+// body performs ops_per_batch operations
+template <typename Setup, typename Body>
+static void run(const char* name, int batches, int ops_per_batch, Setup setup, Body body) {
+    if (name_filter && !strstr(name, name_filter)) {
+        return;
+    }
+
+    using clock = std::chrono::steady_clock;
+    clock::duration elapsed = clock::duration::zero();
+    size_t allocations = 0;
+    for (int batch = 0; batch < batches; batch++) {
+        setup();
+        size_t before = allocation_count;
+        clock::time_point start = clock::now();
+        body();
+        elapsed += clock::now() - start;
+        allocations += allocation_count - before;
+    }
+
+    double ops = (double)batches * ops_per_batch;
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    fprintf(results, "%-44s %10.1f ns/op %8.2f allocs/op\n", name, ns / ops, allocations / ops);
+}
+
+static void reset_controller(SwitchBluetooth& controller) {
+    Timeline& timeline = controller.timeline();
+    timeline.cancel();
+    timeline.peek_due(time_us_64());
+    controller.play_due_events();
+    FastLogger::flush_logs();
+}
+
+static void bench_parser(SwitchBluetooth& controller, CommandParser& parser) {
+    struct Case {
+        const char* name;
+        const char* line;
+    };
+    static const Case cases[] = {
+        {"parse: PRESS a", "PRESS a"},
+        {"parse: HOLD a b x y", "HOLD a b x y"},
+        {"parse: RELEASE dpad_up", "RELEASE dpad_up"},
+        {"parse: STICK left 0.5 -0.25", "STICK left 0.5 -0.25"},
+        {"parse: SLEEP 0.016", "SLEEP 0.016"},
+        {"parse: comment", "# comment"},
+    };
+
+    // Batches stay well inside the timeline's capacity
+    const int LINES = 32;
+    for (const Case& c : cases) {
+        run(c.name, 2000, LINES, [&] { reset_controller(controller); }, [&] {
+            for (int i = 0; i < LINES; i++) {
+                parser.parse_and_execute(c.line, time_us_32());
+            }
+        });
+    }
+}
+
+static void bench_queue(SwitchBluetooth& controller) {
+    const int FRAMES = 64;
+    ButtonMask a, b;
+    ButtonTable::lookup("a", 1, a);
+    ButtonTable::lookup("b", 1, b);
+
+    run("queue: queue_op, immediate", 2000, FRAMES, [&] { reset_controller(controller); }, [&] {
+        for (int i = 0; i < FRAMES; i++) {
+            controller.queue_op(InputOp::button(a, i & 1));
+        }
+    });
+
+    // Four writes consolidated into one frame
+    run("queue: 4 ops consolidated per frame", 2000, FRAMES, [&] { reset_controller(controller); }, [&] {
+        for (int i = 0; i < FRAMES; i++) {
+            controller.start_consolidation();
+            controller.queue_op(InputOp::button(a, true));
+            controller.queue_op(InputOp::button(b, true));
+            controller.queue_op(InputOp::stick(STICK_LEFT, InputOp::STICK_UNIT / 2, -InputOp::STICK_UNIT / 2));
+            controller.queue_op(InputOp::button(a, false));
+            controller.end_consolidation();
+        }
+    });
+
+    // Timeline playback of one due step per frame
+    run("queue: play_due_events, 4 events due", 2000, FRAMES, [&] {
+        reset_controller(controller);
+        Timeline& timeline = controller.timeline();
+        for (int i = 0; i < FRAMES; i++) {
+            timeline.schedule(InputOp::button(a, i & 1));
+            timeline.schedule(InputOp::button(b, i & 1));
+            timeline.schedule(InputOp::stick(STICK_LEFT, 0, InputOp::STICK_UNIT / 2));
+            timeline.schedule(InputOp::stick(STICK_RIGHT, -InputOp::STICK_UNIT / 2, 0));
+            timeline.delay(1);
+        }
+    }, [&] {
+        for (int i = 0; i < FRAMES; i++) {
+            controller.play_due_events();
+        }
+    });
+
+    run("queue: play_due_events, idle", 2000, FRAMES, [&] { reset_controller(controller); }, [&] {
+        for (int i = 0; i < FRAMES; i++) {
+            controller.play_due_events();
+        }
+    });
+}
+
+static void bench_reports(SwitchBluetooth& controller) {
+    struct Case {
+        const char* name;
+        uint8_t subcommand;
+        uint8_t args[5];
+    };
+    static const Case cases[] = {
+        {"report: 0x00 full input", 0x00, {0}},
+        {"report: 0x01 pair", 0x01, {0}},
+        {"report: 0x02 device info", 0x02, {0}},
+        {"report: 0x03 set mode", 0x03, {0x30}},
+        {"report: 0x04 trigger buttons", 0x04, {0}},
+        {"report: 0x08 shipment", 0x08, {0}},
+        {"report: 0x10 spi read 0x6020", 0x10, {0x20, 0x60, 0x00, 0x00, 0x18}},
+        {"report: 0x10 spi read 0x6080", 0x10, {0x80, 0x60, 0x00, 0x00, 0x18}},
+        {"report: 0x10 spi read unknown", 0x10, {0x00, 0x20, 0x00, 0x00, 0x10}},
+        {"report: 0x21 nfc/ir config", 0x21, {0}},
+        {"report: 0x22 nfc/ir state", 0x22, {0}},
+        {"report: 0x30 player lights", 0x30, {0x01}},
+        {"report: 0x40 imu on", 0x40, {0x01}},
+        {"report: 0x41 imu sensitivity", 0x41, {0}},
+        {"report: 0x48 vibration", 0x48, {0x01}},
+        {"report: 0x50 unknown, acked", 0x50, {0}},
+    };
+
+    const int REPORTS = 64;
+    for (const Case& c : cases) {
+        uint8_t request[50] = {0};
+        request[0] = 0x01;
+        request[10] = c.subcommand;
+        memcpy(request + 11, c.args, sizeof(c.args));
+
+        run(c.name, 2000, REPORTS, [] { FastLogger::flush_logs(); }, [&] {
+            for (int i = 0; i < REPORTS; i++) {
+                if (c.subcommand) {
+                    controller.queue_subcommand(0x01, request, sizeof(request));
+                }
+                uint8_t* report = controller.generate_report();
+                hid_device_send_interrupt_message(controller.getHidCid(), report, 50);
+            }
+        });
+    }
+
+    // Input reports with IMU data, as sent every frame once the IMU is on
+    uint8_t imu_on[50] = {0x01};
+    imu_on[10] = 0x40;
+    imu_on[11] = 0x01;
+    controller.queue_subcommand(0x01, imu_on, sizeof(imu_on));
+    controller.generate_report();
+    run("report: 0x00 full input + imu", 2000, REPORTS, [] {}, [&] {
+        for (int i = 0; i < REPORTS; i++) {
+            uint8_t* report = controller.generate_report();
+            hid_device_send_interrupt_message(controller.getHidCid(), report, 50);
+        }
+    });
+}
+
+static void bench_logger() {
+    const int MESSAGES = 16;
+    run("log: log (literal)", 2000, MESSAGES, [] { FastLogger::flush_logs(); }, [] {
+        for (int i = 0; i < MESSAGES; i++) {
+            FastLogger::log("Switch connected - ready for commands");
+        }
+    });
+
+    run("log: log_fmt (%d)", 2000, MESSAGES, [] { FastLogger::flush_logs(); }, [] {
+        for (int i = 0; i < MESSAGES; i++) {
+            FastLogger::log_fmt("Consolidated %d commands into single frame", i);
+        }
+    });
+
+    run("log: log_event (1 arg)", 2000, MESSAGES, [] { FastLogger::flush_logs(); }, [] {
+        for (int i = 0; i < MESSAGES; i++) {
+            FastLogger::log_event(LOG_CONSOLIDATED, i);
+        }
+    });
+
+    // Flush cost per message, with output discarded
+    run("log: flush_logs per message", 2000, MESSAGES, [] {
+        FastLogger::flush_logs();
+        for (int i = 0; i < MESSAGES; i++) {
+            FastLogger::log("Consolidated 4 commands into single frame");
+        }
+    }, [] { FastLogger::flush_logs(); });
+
+    run("log: flush_logs per event", 2000, MESSAGES, [] {
+        FastLogger::flush_logs();
+        for (int i = 0; i < MESSAGES; i++) {
+            FastLogger::log_event(LOG_CONSOLIDATED, 4);
+        }
+    }, [] { FastLogger::flush_logs(); });
+}
+
+static void bench_macro(SwitchBluetooth& controller) {
+    static const char text[] =
+        "LOOP\n"
+        "PRESS a\n"
+        "STICK left 1.0 0.0\n"
+        "SLEEP 0.000001\n"
+        "STICK left 0.0 0.0\n"
+        "ENDLOOP\n";
+    static uint32_t program[256];
+    static MacroAssembler assembler;
+
+    run("macro: assemble 6 lines", 2000, 1, [] {}, [&] {
+        assembler.assemble(text, sizeof(text) - 1, program, 256);
+    });
+
+    uint32_t words = assembler.assemble(text, sizeof(text) - 1, program, 256);
+    controller.vm().start(program, words, 0);
+    const int FRAMES = 64;
+    run("macro: vm frame", 2000, FRAMES, [] { FastLogger::flush_logs(); }, [&] {
+        for (int i = 0; i < FRAMES; i++) {
+            controller.play_due_events();
+        }
+    });
+    controller.vm().stop();
+}
+
+static void bench_serial() {
+    // A burst of STICK lines as the host sends them, received and split
+    // into lines without running them
+    const int LINES = 32;
+    static char burst[LINES * 32];
+    size_t length = 0;
+    for (int i = 0; i < LINES; i++) {
+        length += snprintf(burst + length, sizeof(burst) - length, "STICK left 0.%04d -0.25\r\n", i);
+    }
+
+    run("serial: receive and split a line", 2000, LINES, [&] { host_serial_input(burst, length); }, [] {
+        uint32_t received_us, dropped;
+        while (SerialInput::receive() > 0) {
+            while (SerialInput::next_line(received_us, dropped)) {
+            }
+        }
+    });
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        name_filter = argv[1];
+    }
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+
+    FastLogger::init();
+    static MacroStore store;
+    store.init();
+    static SwitchBluetooth controller;
+    controller.init();
+    static CommandParser parser(&controller, &store);
+    FastLogger::flush_logs();
+
+    bench_parser(controller, parser);
+    bench_queue(controller);
+    bench_reports(controller);
+    bench_logger();
+    bench_macro(controller);
+    bench_serial();
+
+    fclose(results);
+    return 0;
+}
@@ -0,0 +1,84 @@
+// Decodes the binary log stream of a SWITCH_BINARY_LOG build back to text,
+// using the format strings compiled into the firmware (LogMessages.h).
+//
+//   log_decode [capture.bin]     # or read the serial port on stdin
+//
+// Each line is prefixed with the device timestamp in seconds. Bytes outside
+// a valid frame are skipped until the next sync byte.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "LogMessages.h"
+
+static bool read_bytes(FILE* in, uint8_t* data, int length) {
+    return fread(data, 1, length, in) == (size_t)length;
+}
+
+static uint32_t read_u32(const uint8_t* data) {
+    return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+// Prints one frame payload, or returns false if it does not decode
+static bool print_frame(const uint8_t* payload, int length) {
+    if (length < 2) {
+        return false;
+    }
+    uint16_t id = payload[0] | payload[1] << 8;
+
+    if (id == LOG_TEXT_ID) {
+        printf("%.*s\n", length - 2, (const char*)payload + 2);
+        return true;
+    }
+    if (id >= LOG_COUNT || length != 6 + 4 * LOG_ARG_COUNTS.count[id]) {
+        return false;
+    }
+
+    uint32_t timestamp = read_u32(payload + 2);
+    uint32_t args[LOG_MAX_ARGS] = {};
+    for (int i = 0; i < LOG_ARG_COUNTS.count[id]; i++) {
+        args[i] = read_u32(payload + 6 + 4 * i);
+    }
+    printf("[%u.%06u] ", (unsigned)(timestamp / 1000000), (unsigned)(timestamp % 1000000));
+    printf(LOG_FORMATS[id], args[0], args[1], args[2], args[3]);
+    printf("\n");
+    return true;
+}
+
+int main(int argc, char** argv) {
+    FILE* in = stdin;
+    if (argc > 1) {
+        in = fopen(argv[1], "rb");
+        if (!in) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    uint32_t skipped = 0;
+    int byte;
+    while ((byte = fgetc(in)) != EOF) {
+        if (byte != LOG_FRAME_SYNC) {
+            skipped++;
+            continue;
+        }
+
+        int length = fgetc(in);
+        uint8_t payload[255];
+        if (length == EOF || !read_bytes(in, payload, length)) {
+            break;
+        }
+        if (!print_frame(payload, length)) {
+            skipped += 2 + length;
+        }
+        fflush(stdout);
+    }
+
+    if (skipped > 0) {
+        fprintf(stderr, "log_decode: skipped %u bytes outside valid frames\n", (unsigned)skipped);
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
+    return 0;
+}
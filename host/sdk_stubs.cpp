@@ -0,0 +1,173 @@
+// Definitions behind the host stub headers
+
+#include <chrono>
+#include <cstring>
+#include <random>
+
+#include "btstack.h"
+#include "hardware/flash.h"
+#include "pico/flash.h"
+#include "pico/rand.h"
+#include "pico/stdio_usb.h"
+#include "pico/stdlib.h"
+
+uint8_t host_flash_image[PICO_FLASH_SIZE_BYTES];
+
+// The simulated flash starts out erased
+static const bool host_flash_erased = (memset(host_flash_image, 0xFF, sizeof(host_flash_image)), true);
+
+// Linker symbol marking the end of the firmware image; the host build
+// pretends the image fills the first 512 KB of the simulated flash
+asm(".globl __flash_binary_end\n"
+    ".set __flash_binary_end, host_flash_image + 0x80000");
+uint32_t host_hid_reports_sent = 0;
+
+uint64_t time_us_64(void) {
+    static const auto boot = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot).count();
+}
+
+bool stdio_init_all(void) { return true; }
+
+int stdio_put_string(const char *s, int len, bool newline, bool cr_translation) {
+    for (int i = 0; i < len; i++) {
+        if (cr_translation && s[i] == '\n') {
+            putchar('\r');
+        }
+        putchar(s[i]);
+    }
+    if (newline) {
+        putchar('\n');
+    }
+    return len;
+}
+
+// Serial input queued by host_serial_input, read back at most one TinyUSB
+// RX FIFO (256 bytes) per call like the real driver
+static char host_serial_buffer[1 << 16];
+static size_t host_serial_head = 0;
+static size_t host_serial_tail = 0;
+
+void host_serial_input(const void *data, size_t length) {
+    if (host_serial_head == host_serial_tail) {
+        host_serial_head = host_serial_tail = 0;
+    }
+    if (length > sizeof(host_serial_buffer) - host_serial_tail) {
+        length = sizeof(host_serial_buffer) - host_serial_tail;
+    }
+    memcpy(host_serial_buffer + host_serial_tail, data, length);
+    host_serial_tail += length;
+}
+
+static int host_serial_in_chars(char *buf, int len) {
+    size_t count = host_serial_tail - host_serial_head;
+    if (count > (size_t)len) {
+        count = len;
+    }
+    if (count > 256) {
+        count = 256;
+    }
+    memcpy(buf, host_serial_buffer + host_serial_head, count);
+    host_serial_head += count;
+    return count ? (int)count : PICO_ERROR_NO_DATA;
+}
+
+stdio_driver_t stdio_usb = {host_serial_in_chars};
+
+uint32_t get_rand_32(void) {
+    static std::minstd_rand rng(0x5EED);
+    return rng();
+}
+
+// NOR flash semantics: erase sets bits, programming can only clear them
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    memset(host_flash_image + flash_offs, 0xFF, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        host_flash_image[flash_offs + i] &= data[i];
+    }
+}
+
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t) {
+    func(param);
+    return PICO_OK;
+}
+
+bool flash_safe_execute_core_init(void) { return true; }
+
+void gap_discoverable_control(uint8_t) {}
+void gap_set_class_of_device(uint32_t) {}
+void gap_set_local_name(const char *) {}
+void gap_set_default_link_policy_settings(uint16_t) {}
+void gap_set_allow_role_switch(bool) {}
+void hci_set_bd_addr(bd_addr_t) {}
+void hci_add_event_handler(btstack_packet_callback_registration_t *) {}
+int hci_power_control(int) { return 0; }
+void l2cap_init(void) {}
+void sm_init(void) {}
+
+void hid_device_init(uint8_t, uint16_t, const uint8_t *) {}
+void hid_device_register_packet_handler(btstack_packet_handler_t) {}
+void hid_device_register_report_data_callback(void (*)(uint16_t, hid_report_type_t, uint16_t, int, uint8_t *)) {}
+uint8_t hid_device_connect(bd_addr_t, uint16_t *hid_cid) {
+    *hid_cid = 0;
+    return 0;
+}
+void hid_device_request_can_send_now_event(uint16_t) {}
+void hid_device_send_interrupt_message(uint16_t, const uint8_t *, uint16_t) { host_hid_reports_sent++; }
+
+void btstack_run_loop_set_timer(btstack_timer_source_t *, uint32_t) {}
+void btstack_run_loop_add_timer(btstack_timer_source_t *) {}
+void btstack_run_loop_execute(void) {}
+
+// A handful of small tags is all the firmware stores
+struct HostTlvEntry {
+    uint32_t tag;
+    uint32_t size;
+    uint8_t data[32];
+};
+static HostTlvEntry host_tlv_entries[8];
+
+static int host_tlv_get_tag(void *, uint32_t tag, uint8_t *buffer, uint32_t buffer_size) {
+    for (const HostTlvEntry &entry : host_tlv_entries) {
+        if (entry.tag == tag && entry.size > 0) {
+            uint32_t size = entry.size < buffer_size ? entry.size : buffer_size;
+            memcpy(buffer, entry.data, size);
+            return entry.size;
+        }
+    }
+    return 0;
+}
+
+static void host_tlv_delete_tag(void *, uint32_t tag) {
+    for (HostTlvEntry &entry : host_tlv_entries) {
+        if (entry.tag == tag) {
+            entry.size = 0;
+        }
+    }
+}
+
+static int host_tlv_store_tag(void *, uint32_t tag, const uint8_t *data, uint32_t data_size) {
+    if (data_size > sizeof(HostTlvEntry::data)) {
+        return 1;
+    }
+    host_tlv_delete_tag(nullptr, tag);
+    for (HostTlvEntry &entry : host_tlv_entries) {
+        if (entry.size == 0) {
+            entry.tag = tag;
+            entry.size = data_size;
+            memcpy(entry.data, data, data_size);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static const btstack_tlv_t host_tlv = {host_tlv_get_tag, host_tlv_store_tag, host_tlv_delete_tag};
+
+void btstack_tlv_get_instance(const btstack_tlv_t **tlv_impl, void **tlv_context) {
+    *tlv_impl = &host_tlv;
+    *tlv_context = nullptr;
+}
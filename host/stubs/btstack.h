@@ -0,0 +1,83 @@
+#ifndef HOST_BTSTACK_H
+#define HOST_BTSTACK_H
+
+// Host stand-in for the BTstack API used by the firmware. Calls that would
+// reach the radio are no-ops; sent reports are counted so benchmarks can
+// check that work was done.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint8_t bd_addr_t[6];
+typedef int hid_report_type_t;
+
+typedef struct btstack_timer_source {
+    void (*process)(struct btstack_timer_source *ts);
+} btstack_timer_source_t;
+
+typedef void (*btstack_packet_handler_t)(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+
+typedef struct {
+    btstack_packet_handler_t callback;
+} btstack_packet_callback_registration_t;
+
+typedef struct {
+    int (*get_tag)(void *context, uint32_t tag, uint8_t *buffer, uint32_t buffer_size);
+    int (*store_tag)(void *context, uint32_t tag, const uint8_t *data, uint32_t data_size);
+    void (*delete_tag)(void *context, uint32_t tag);
+} btstack_tlv_t;
+
+#define HCI_EVENT_PACKET 0x04
+#define BTSTACK_EVENT_STATE 0x60
+#define HCI_STATE_WORKING 2
+#define HCI_EVENT_HID_META 0xEF
+#define HID_SUBEVENT_CONNECTION_OPENED 0x02
+#define HID_SUBEVENT_CONNECTION_CLOSED 0x03
+#define HID_SUBEVENT_CAN_SEND_NOW 0x04
+#define LM_LINK_POLICY_ENABLE_ROLE_SWITCH 0x01
+#define LM_LINK_POLICY_ENABLE_SNIFF_MODE 0x04
+#define HCI_POWER_ON 1
+
+static inline uint8_t hci_event_hid_meta_get_subevent_code(const uint8_t *event) { return event[2]; }
+static inline uint8_t hid_subevent_connection_opened_get_status(const uint8_t *event) { return event[5]; }
+static inline uint16_t hid_subevent_connection_opened_get_hid_cid(const uint8_t *event) {
+    return event[3] | (event[4] << 8);
+}
+static inline void hid_subevent_connection_opened_get_bd_addr(const uint8_t *event, uint8_t *address) {
+    for (int i = 0; i < 6; i++) {
+        address[i] = event[11 - i];
+    }
+}
+static inline uint8_t btstack_event_state_get_state(const uint8_t *event) { return event[2]; }
+
+// Host TLV store kept in memory, empty at start
+void btstack_tlv_get_instance(const btstack_tlv_t **tlv_impl, void **tlv_context);
+
+void gap_discoverable_control(uint8_t enable);
+void gap_set_class_of_device(uint32_t class_of_device);
+void gap_set_local_name(const char *local_name);
+void gap_set_default_link_policy_settings(uint16_t settings);
+void gap_set_allow_role_switch(bool allow_role_switch);
+void hci_set_bd_addr(bd_addr_t addr);
+void hci_add_event_handler(btstack_packet_callback_registration_t *callback_handler);
+int hci_power_control(int power_mode);
+void l2cap_init(void);
+void sm_init(void);
+
+void hid_device_init(uint8_t boot_protocol_mode_supported, uint16_t descriptor_len, const uint8_t *descriptor);
+void hid_device_register_packet_handler(btstack_packet_handler_t callback);
+void hid_device_register_report_data_callback(void (*callback)(uint16_t cid, hid_report_type_t report_type,
+                                                               uint16_t report_id, int report_size,
+                                                               uint8_t *report));
+uint8_t hid_device_connect(bd_addr_t addr, uint16_t *hid_cid);
+void hid_device_request_can_send_now_event(uint16_t hid_cid);
+void hid_device_send_interrupt_message(uint16_t hid_cid, const uint8_t *message, uint16_t message_len);
+
+void btstack_run_loop_set_timer(btstack_timer_source_t *ts, uint32_t timeout_in_ms);
+void btstack_run_loop_add_timer(btstack_timer_source_t *ts);
+void btstack_run_loop_execute(void);
+
+// Host only: reports passed to hid_device_send_interrupt_message
+extern uint32_t host_hid_reports_sent;
+
+#endif
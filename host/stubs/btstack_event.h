@@ -0,0 +1,6 @@
+#ifndef HOST_BTSTACK_EVENT_H
+#define HOST_BTSTACK_EVENT_H
+
+#include "btstack.h"
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_BTSTACK_RUN_LOOP_H
+#define HOST_BTSTACK_RUN_LOOP_H
+
+#include "btstack.h"
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef HOST_HARDWARE_SYNC_H
+#define HOST_HARDWARE_SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <atomic>
+
+static inline void __dmb(void) { std::atomic_thread_fence(std::memory_order_seq_cst); }
+
+// The host build is single threaded, so spinlocks never contend
+typedef volatile uint32_t spin_lock_t;
+
+static inline int spin_lock_claim_unused(bool) { return 0; }
+static inline spin_lock_t *spin_lock_init(unsigned int) {
+    static spin_lock_t lock;
+    return &lock;
+}
+static inline uint32_t spin_lock_blocking(spin_lock_t *) { return 0; }
+static inline void spin_unlock(spin_lock_t *, uint32_t) {}
+
+#endif
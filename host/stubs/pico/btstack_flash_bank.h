@@ -0,0 +1,9 @@
+#ifndef HOST_PICO_BTSTACK_FLASH_BANK_H
+#define HOST_PICO_BTSTACK_FLASH_BANK_H
+
+#include "hardware/flash.h"
+
+#define PICO_FLASH_BANK_TOTAL_SIZE (FLASH_SECTOR_SIZE * 2u)
+#define PICO_FLASH_BANK_STORAGE_OFFSET (PICO_FLASH_SIZE_BYTES - PICO_FLASH_BANK_TOTAL_SIZE)
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef HOST_PICO_CRITICAL_SECTION_H
+#define HOST_PICO_CRITICAL_SECTION_H
+
+// The host build is single threaded
+typedef struct {
+    int unused;
+} critical_section_t;
+
+static inline void critical_section_init(critical_section_t *) {}
+static inline void critical_section_enter_blocking(critical_section_t *) {}
+static inline void critical_section_exit(critical_section_t *) {}
+
+#endif
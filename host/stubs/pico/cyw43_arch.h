@@ -0,0 +1,6 @@
+#ifndef HOST_PICO_CYW43_ARCH_H
+#define HOST_PICO_CYW43_ARCH_H
+
+static inline int cyw43_arch_init(void) { return 0; }
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_PICO_MULTICORE_H
+#define HOST_PICO_MULTICORE_H
+
+void multicore_launch_core1(void (*entry)(void));
+
+#endif
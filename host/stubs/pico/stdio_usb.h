@@ -0,0 +1,16 @@
+#ifndef HOST_PICO_STDIO_USB_H
+#define HOST_PICO_STDIO_USB_H
+
+#include <stddef.h>
+
+// Host stand-in for the USB stdio driver; only the bulk read is used
+typedef struct stdio_driver {
+    int (*in_chars)(char *buf, int len);
+} stdio_driver_t;
+
+extern stdio_driver_t stdio_usb;
+
+// Host only: queue bytes as if the host PC had sent them over CDC
+void host_serial_input(const void *data, size_t length);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef HOST_PICO_STDLIB_H
+#define HOST_PICO_STDLIB_H
+
+// Host stand-in for the parts of the Pico SDK the core modules use
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef uint64_t absolute_time_t;
+
+#define PICO_ERROR_TIMEOUT (-1)
+#define PICO_ERROR_NO_DATA (-3)
+
+uint64_t time_us_64(void);
+static inline uint32_t time_us_32(void) { return (uint32_t)time_us_64(); }
+static inline absolute_time_t get_absolute_time(void) { return time_us_64(); }
+static inline uint32_t to_ms_since_boot(absolute_time_t t) { return (uint32_t)(t / 1000); }
+static inline void tight_loop_contents(void) {}
+
+bool stdio_init_all(void);
+int stdio_put_string(const char *s, int len, bool newline, bool cr_translation);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef HOST_TUSB_H
+#define HOST_TUSB_H
+
+#include <stdint.h>
+
+// Free space in the CDC TX FIFO; the host drains it instantly
+static inline uint32_t tud_cdc_write_available(void) { return 256; }
+
+#endif
@@ -0,0 +1,429 @@
+// Host tests for the firmware core, built against the stub SDK headers and
+// run by ctest. The flash stub keeps NOR semantics (erase sets bytes to
+// 0xFF, programming can only clear bits), so the macro store is exercised
+// the way it behaves on the chip.
+//
+//   switch_tests   runs every test, exits non-zero if any check fails
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "ButtonTable.h"
+#include "CommandParser.h"
+#include "FastLogger.h"
+#include "MacroAssembler.h"
+#include "MacroStore.h"
+#include "MacroVM.h"
+#include "SerialInput.h"
+#include "SwitchBluetooth.h"
+#include "hardware/flash.h"
+#include "pico/stdio_usb.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                   \
+    do {                                                                              \
+        if (!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);  \
+            failures++;                                                               \
+        }                                                                             \
+    } while (0)
+
+// ---------------------------------------------------------------------------
+// SerialInput
+
+// Every line the ring hands out for the input queued so far, with the
+// overlong lines it dropped on the way
+static std::vector<std::string> drain_serial(uint32_t budget, uint32_t& dropped) {
+    std::vector<std::string> lines;
+    dropped = 0;
+    while (SerialInput::receive(budget) > 0 || SerialInput::buffered() > 0) {
+        uint32_t received_us;
+        uint32_t skipped;
+        const char* line;
+        bool any = false;
+        while (true) {
+            line = SerialInput::next_line(received_us, skipped);
+            dropped += skipped;
+            if (!line) {
+                break;
+            }
+            lines.push_back(line);
+            any = true;
+        }
+        if (!any && SerialInput::buffered() > 0 && SerialInput::receive(budget) == 0) {
+            break;  // A partial line waits for more input
+        }
+    }
+    return lines;
+}
+
+static void test_serial_wrap() {
+    // Small reads make lines straddle the end of the ring over and over
+    const int count = 3000;
+    for (int i = 0; i < count; i++) {
+        char line[64];
+        int length = snprintf(line, sizeof(line), "LINE %d%s\n", i, i % 7 ? "" : " padding-padding-padding");
+        host_serial_input(line, length);
+    }
+
+    uint32_t dropped;
+    std::vector<std::string> lines = drain_serial(37, dropped);
+    CHECK(dropped == 0);
+    CHECK(lines.size() == (size_t)count);
+    for (size_t i = 0; i < lines.size(); i++) {
+        char expected[64];
+        snprintf(expected, sizeof(expected), "LINE %d%s", (int)i, i % 7 ? "" : " padding-padding-padding");
+        if (lines[i] != expected) {
+            fprintf(stderr, "line %u: got \"%s\"\n", (unsigned)i, lines[i].c_str());
+            CHECK(lines[i] == expected);
+            break;
+        }
+    }
+}
+
+static void test_serial_line_ends() {
+    // CRLF, blank lines and a line split across two USB transfers
+    const char first[] = "PRESS a\r\n\r\n\nHOLD b\nREL";
+    const char second[] = "EASE b\n";
+    host_serial_input(first, sizeof(first) - 1);
+    uint32_t dropped;
+    std::vector<std::string> lines = drain_serial(SWITCH_CONFIG.serial_budget, dropped);
+    host_serial_input(second, sizeof(second) - 1);
+    std::vector<std::string> rest = drain_serial(SWITCH_CONFIG.serial_budget, dropped);
+    lines.insert(lines.end(), rest.begin(), rest.end());
+
+    CHECK(lines.size() == 3);
+    CHECK(lines.size() == 3 && lines[0] == "PRESS a" && lines[1] == "HOLD b" && lines[2] == "RELEASE b");
+}
+
+static void test_serial_overlong() {
+    uint32_t overruns = SerialInput::overruns();
+    std::string longest(SerialInput::MAX_LINE, 'y');
+    std::string input = "A\n" + std::string(SerialInput::MAX_LINE + 1, 'x') + "\n" +
+                        std::string(3 * SerialInput::BUFFER_SIZE, 'z') + "\n" + longest + "\nB\n";
+    host_serial_input(input.data(), input.size());
+
+    uint32_t dropped;
+    std::vector<std::string> lines = drain_serial(SWITCH_CONFIG.serial_budget, dropped);
+    CHECK(dropped == 2);
+    CHECK(SerialInput::overruns() - overruns == 2);
+    CHECK(lines.size() == 3);
+    CHECK(lines.size() == 3 && lines[0] == "A" && lines[1] == longest && lines[2] == "B");
+    CHECK(SerialInput::buffered() == 0);
+}
+
+// ---------------------------------------------------------------------------
+// CommandParser
+
+static void test_parser_errors(CommandParser& parser) {
+    CHECK(parser.parse_and_execute("PRESS a", 0) == CommandParser::ERROR_NONE);
+    CHECK(parser.parse_and_execute("press A 5f", 0) == CommandParser::ERROR_NONE);
+    CHECK(parser.parse_and_execute("", 0) == CommandParser::ERROR_NONE);
+    CHECK(parser.parse_and_execute("# comment", 0) == CommandParser::ERROR_NONE);
+    CHECK(parser.parse_and_execute("STICK left 0.5 -1", 0) == CommandParser::ERROR_NONE);
+    CHECK(parser.parse_and_execute("RELEASE a", 0) == CommandParser::ERROR_NONE);
+    CHECK(parser.parse_and_execute("SPIWRITE 6050 ff00ff", 0) == CommandParser::ERROR_NONE);
+
+    CHECK(parser.parse_and_execute("JUMP", 0) == CommandParser::ERROR_UNKNOWN_COMMAND);
+    CHECK(parser.parse_and_execute("PRESSA", 0) == CommandParser::ERROR_UNKNOWN_COMMAND);
+
+    CHECK(parser.parse_and_execute("PRESS nosuch", 0) == CommandParser::ERROR_UNKNOWN_BUTTON);
+    CHECK(parser.parse_and_execute("HOLD a nosuch", 0) == CommandParser::ERROR_UNKNOWN_BUTTON);
+
+    CHECK(parser.parse_and_execute("PRESS a 0f", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+    CHECK(parser.parse_and_execute("PRESS a 256f", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+    CHECK(parser.parse_and_execute("SLEEP", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+    CHECK(parser.parse_and_execute("SLEEP soon", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+    CHECK(parser.parse_and_execute("STICK left 0.5", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+    CHECK(parser.parse_and_execute("UPLOAD 16 10", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+    CHECK(parser.parse_and_execute("UPLOAD -1 10", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+    CHECK(parser.parse_and_execute("UPLOAD 4294967297 10", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+    CHECK(parser.parse_and_execute("RUN 1 2 3", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+    CHECK(parser.parse_and_execute("SPIWRITE -1 00", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+    CHECK(parser.parse_and_execute("SPIWRITE 0x6050 00", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+    CHECK(parser.parse_and_execute("SPIWRITE 100000000 00", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+    CHECK(parser.parse_and_execute("SPIWRITE 6050", 0) == CommandParser::ERROR_BAD_ARGUMENT);
+
+    // Nothing has been uploaded to this slot
+    CHECK(parser.parse_and_execute("RUN 15", 0) == CommandParser::ERROR_REJECTED);
+
+    // Nothing plays the timeline here, so it fills up
+    CommandParser::Error error = CommandParser::ERROR_NONE;
+    for (uint32_t i = 0; i <= Timeline::CAPACITY && error == CommandParser::ERROR_NONE; i++) {
+        error = parser.parse_and_execute("HOLD a", 0);
+    }
+    CHECK(error == CommandParser::ERROR_TIMELINE_FULL);
+}
+
+// ---------------------------------------------------------------------------
+// MacroStore
+
+// One chunk as the host tool frames it: sync, offset, length, CRC, data
+static void send_chunk(MacroStore& store, uint32_t offset, const char* data, uint16_t length,
+                       bool corrupt = false) {
+    uint32_t crc = MacroStore::crc32(reinterpret_cast<const uint8_t*>(data), length);
+    if (corrupt) {
+        crc ^= 1;
+    }
+    store.receive(MacroStore::CHUNK_SYNC);
+    for (int i = 0; i < 4; i++) {
+        store.receive((uint8_t)(offset >> (8 * i)));
+    }
+    for (int i = 0; i < 2; i++) {
+        store.receive((uint8_t)(length >> (8 * i)));
+    }
+    for (int i = 0; i < 4; i++) {
+        store.receive((uint8_t)(crc >> (8 * i)));
+    }
+    for (uint16_t i = 0; i < length; i++) {
+        store.receive((uint8_t)data[i]);
+    }
+}
+
+// UPLOAD, then the polls that erase ahead of the record until READY
+static bool start_upload(MacroStore& store, uint32_t slot, uint32_t length) {
+    if (!store.begin_upload(slot, length)) {
+        return false;
+    }
+    while (store.is_preparing()) {
+        store.poll();
+    }
+    return store.is_receiving();
+}
+
+static bool holds(MacroStore& store, uint32_t slot, const char* text) {
+    const uint8_t* data;
+    uint32_t length;
+    return store.find(slot, data, length) && length == strlen(text) && memcmp(data, text, length) == 0;
+}
+
+static void test_store_upload() {
+    MacroStore store;
+    store.init();
+    store.erase_all();
+    while (store.is_erasing()) {
+        store.poll();
+    }
+
+    // Single chunk
+    CHECK(start_upload(store, 2, 5));
+    send_chunk(store, 0, "hello", 5);
+    CHECK(!store.is_receiving());
+    CHECK(holds(store, 2, "hello"));
+
+    // A newer upload replaces the slot; a corrupt chunk is refused and resent
+    const char text[] = "PRESS a\nSLEEP 0.1\n";
+    const uint16_t length = sizeof(text) - 1;
+    CHECK(start_upload(store, 2, length));
+    send_chunk(store, 0, text, 8);
+    send_chunk(store, 8, text + 8, length - 8, true);
+    CHECK(store.is_receiving());
+    send_chunk(store, 8, text + 8, length - 8);
+    CHECK(!store.is_receiving());
+    CHECK(holds(store, 2, text));
+
+    // Slots out of range are refused
+    CHECK(!store.begin_upload(MacroStore::MAX_SLOTS, 5));
+    const uint8_t* data;
+    uint32_t found;
+    CHECK(!store.find(MacroStore::MAX_SLOTS + 256, data, found));
+
+    // An upload cut short is never committed, so a rescan after a reset
+    // still finds the previous version
+    CHECK(start_upload(store, 2, 10));
+    send_chunk(store, 0, "abc", 3);
+    CHECK(!store.begin_upload(5, 3));
+
+    MacroStore rescanned;
+    rescanned.init();
+    CHECK(holds(rescanned, 2, text));
+    CHECK(start_upload(rescanned, 5, 3));
+    send_chunk(rescanned, 0, "xyz", 3);
+    CHECK(holds(rescanned, 5, "xyz"));
+}
+
+static void test_store_erase() {
+    MacroStore store;
+    store.init();
+    CHECK(start_upload(store, 7, 3));
+    send_chunk(store, 0, "abc", 3);
+    CHECK(holds(store, 7, "abc"));
+
+    // One sector per poll; uploads wait until the erase is done
+    store.erase_all();
+    CHECK(!store.begin_upload(7, 3));
+    uint32_t polls = 0;
+    while (store.is_erasing()) {
+        store.poll();
+        polls++;
+    }
+    CHECK(polls == MacroStore::STORE_SIZE / FLASH_SECTOR_SIZE);
+    CHECK(!holds(store, 7, "abc"));
+
+    MacroStore rescanned;
+    rescanned.init();
+    CHECK(!holds(rescanned, 7, "abc"));
+    CHECK(start_upload(rescanned, 7, 3));
+    send_chunk(rescanned, 0, "def", 3);
+    CHECK(holds(rescanned, 7, "def"));
+
+    // After a reset only the log's current sector is known to be erased, so
+    // a bigger record gets one erase per poll, all of them before READY
+    MacroStore reset;
+    reset.init();
+    std::string big(3 * FLASH_SECTOR_SIZE, 'x');
+    CHECK(reset.begin_upload(3, big.size()));
+    CHECK(!reset.is_receiving());
+    polls = 0;
+    while (reset.is_preparing()) {
+        reset.poll();
+        polls++;
+    }
+    CHECK(polls == 3);
+    CHECK(reset.is_receiving());
+    for (uint32_t offset = 0; offset < big.size(); offset += MacroStore::MAX_CHUNK) {
+        send_chunk(reset, offset, big.data() + offset, MacroStore::MAX_CHUNK);
+    }
+    CHECK(holds(reset, 3, big.c_str()));
+}
+
+// ---------------------------------------------------------------------------
+// MacroAssembler
+
+static uint32_t assemble(const char* text, uint32_t* code, uint32_t capacity) {
+    MacroAssembler assembler;
+    return assembler.assemble(text, strlen(text), code, capacity);
+}
+
+static void test_assembler_encoding() {
+    ButtonMask a;
+    CHECK(ButtonTable::lookup("a", 1, a));
+
+    const char* text =
+        "start:\n"
+        "  LOOP 3\n"
+        "    PRESS a\n"
+        "  ENDLOOP\n"
+        "SET c1 2\n"
+        "# counted loop\n"
+        "again:\n"
+        "DEC c1\n"
+        "JNZ c1 Again\n"
+        "JUMP start\n";
+    const uint32_t expected[] = {
+        MacroVM::MAGIC,
+        MacroVM::encode(MacroVM::OP_LOOP, 3),
+        MacroVM::encode(MacroVM::OP_BUTTON_DOWN, a.index, a.mask),
+        MacroVM::encode(MacroVM::OP_WAIT_FRAMES, CommandParser::DEFAULT_PRESS_FRAMES),
+        MacroVM::encode(MacroVM::OP_BUTTON_UP, a.index, a.mask),
+        MacroVM::encode(MacroVM::OP_ENDLOOP),
+        MacroVM::encode(MacroVM::OP_SET, 1, 2),
+        MacroVM::encode(MacroVM::OP_DEC, 1, 0),
+        MacroVM::encode(MacroVM::OP_JNZ, 1, 7),
+        MacroVM::encode(MacroVM::OP_JUMP, 1),
+        MacroVM::encode(MacroVM::OP_HALT),
+    };
+    uint32_t code[64];
+    uint32_t words = assemble(text, code, 64);
+    CHECK(words == sizeof(expected) / sizeof(expected[0]));
+    CHECK(words == sizeof(expected) / sizeof(expected[0]) && memcmp(code, expected, sizeof(expected)) == 0);
+
+    // Forward references are patched once the label is seen
+    const char* forward = "JUMP end\nHALT\nend:\n";
+    words = assemble(forward, code, 64);
+    CHECK(words == 4);
+    CHECK(words == 4 && code[1] == MacroVM::encode(MacroVM::OP_JUMP, 3));
+}
+
+static void test_assembler_errors() {
+    uint32_t code[64];
+    CHECK(assemble("JUMP nowhere\n", code, 64) == 0);
+    CHECK(assemble("here:\nhere:\n", code, 64) == 0);
+    CHECK(assemble("ENDLOOP\n", code, 64) == 0);
+    CHECK(assemble("LOOP 2\nHALT\n", code, 64) == 0);
+    CHECK(assemble("LOOP 2 3\nENDLOOP\n", code, 64) == 0);
+    CHECK(assemble("HALT now\n", code, 64) == 0);
+    CHECK(assemble("HOLD\n", code, 64) == 0);
+    CHECK(assemble("RELEASE\n", code, 64) == 0);
+    CHECK(assemble("PRESS 5f\n", code, 64) == 0);
+    CHECK(assemble("SET c8 1\n", code, 64) == 0);
+    CHECK(assemble("averyveryverylonglabel:\n", code, 64) == 0);
+    CHECK(assemble(("PRESS a" + std::string(130, ' ') + "\n").c_str(), code, 64) == 0);
+    CHECK(assemble("PRESS a\nPRESS a\n", code, 4) == 0);
+
+    // Nesting up to the VM's depth is fine, one more is not
+    std::string nested;
+    for (int i = 0; i < MacroVM::LOOP_DEPTH; i++) {
+        nested += "LOOP 2\n";
+    }
+    for (int i = 0; i < MacroVM::LOOP_DEPTH; i++) {
+        nested += "ENDLOOP\n";
+    }
+    CHECK(assemble(nested.c_str(), code, 64) != 0);
+    CHECK(assemble(("LOOP 2\n" + nested + "ENDLOOP\n").c_str(), code, 64) == 0);
+}
+
+// ---------------------------------------------------------------------------
+// MacroVM
+
+static void test_vm_stick_stops_motion() {
+    // A macro setting a stick takes it over from a running circle, while a
+    // motion on the other stick keeps going
+    StickMotion motion;
+    motion.start(InputOp::stick_motion(STICK_LEFT, StickMotion::MOTION_CIRCLE, 0x400, 0x400, 60));
+    motion.start(InputOp::stick_motion(STICK_RIGHT, StickMotion::MOTION_CIRCLE, 0x400, 0x400, 60));
+
+    uint32_t code[8];
+    uint32_t words = assemble("STICK left 0.5 0.5\n", code, 8);
+    CHECK(words != 0);
+
+    MacroVM vm;
+    InputQueue queue;
+    CHECK(vm.start(code, words, 1));
+    vm.run_frame(0, 0, queue, motion);
+    CHECK(motion.is_active());
+
+    motion.stop(STICK_RIGHT);
+    CHECK(!motion.is_active());
+}
+
+int main() {
+    FastLogger::init();
+
+    test_serial_wrap();
+    test_serial_line_ends();
+    test_serial_overlong();
+
+    // Tests share the flash image, so the parser sees an empty store
+    static MacroStore store;
+    store.init();
+    store.erase_all();
+    while (store.is_erasing()) {
+        store.poll();
+    }
+    static SwitchBluetooth controller;
+    controller.init();
+    static CommandParser parser(&controller, &store);
+    test_parser_errors(parser);
+
+    test_store_upload();
+    test_store_erase();
+
+    test_assembler_encoding();
+    test_assembler_errors();
+
+    test_vm_stick_stops_motion();
+
+    while (FastLogger::has_pending_logs()) {
+        FastLogger::flush_logs();
+    }
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All tests passed\n");
+    return 0;
+}
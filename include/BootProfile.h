@@ -0,0 +1,33 @@
+#ifndef BootProfile_h
+#define BootProfile_h
+
+#include <stdint.h>
+
+// Microsecond timestamps, counted from reset, of each init step and of the
+// first connection milestones, reported by BOOTSTATS. Only the first time a
+// phase is reached is kept, so reconnects don't overwrite the boot figures.
+class BootProfile {
+public:
+    enum Phase : uint8_t {
+        MAIN,           // main() entered
+        RADIO_READY,    // cyw43_arch_init done (radio and BT firmware loaded)
+        STACK_READY,    // L2CAP, SM and HID device set up
+        POWER_ON,       // hci_power_control called
+        USB_READY,      // stdio_init_all done
+        STORE_READY,    // Macro store scanned
+        DISCOVERABLE,   // HCI working, page/inquiry scan on
+        CONNECTED,      // First HID connection opened
+        DEVICE_INFO,    // Console queried the device info
+        FIRST_REPORT,   // First full input report
+        PHASES
+    };
+
+    static void mark(Phase phase);
+    static uint32_t at(Phase phase) { return _times[phase]; }
+    static const char* name(Phase phase);
+
+private:
+    static uint32_t _times[PHASES];  // 0 = not reached yet
+};
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef ButtonTable_h
+#define ButtonTable_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SwitchConsts.h"
+
+// Pseudo byte index for d-pad directions. The d-pad is kept as a bitmap of
+// SWITCH_HAT_UP/DOWN/LEFT/RIGHT and turned into the HAT nibble when applied.
+#define BUTTON_INDEX_DPAD 3
+
+#define STICK_LEFT 0
+#define STICK_RIGHT 1
+
+// Where a button lives in SwitchReport::buttons
+struct ButtonMask {
+  uint8_t index;
+  uint8_t mask;
+};
+
+// Compile-time perfect hash from button name to ButtonMask.
+// The seed is searched for by the compiler so every name gets its own slot;
+// a lookup is one hash, one table read and one string compare.
+namespace ButtonTable {
+
+struct Entry {
+  const char *name;
+  ButtonMask button;
+};
+
+constexpr Entry ENTRIES[] = {
+    {"y", {0, SWITCH_MASK_Y}},
+    {"x", {0, SWITCH_MASK_X}},
+    {"b", {0, SWITCH_MASK_B}},
+    {"a", {0, SWITCH_MASK_A}},
+    {"r", {0, SWITCH_MASK_R}},
+    {"zr", {0, SWITCH_MASK_ZR}},
+    {"minus", {1, SWITCH_MASK_MINUS}},
+    {"plus", {1, SWITCH_MASK_PLUS}},
+    {"r_stick", {1, SWITCH_MASK_R3}},
+    {"l_stick", {1, SWITCH_MASK_L3}},
+    {"home", {1, SWITCH_MASK_HOME}},
+    {"capture", {1, SWITCH_MASK_CAPTURE}},
+    {"l", {2, SWITCH_MASK_L}},
+    {"zl", {2, SWITCH_MASK_ZL}},
+    {"dpad_up", {BUTTON_INDEX_DPAD, SWITCH_HAT_UP}},
+    {"dpad_down", {BUTTON_INDEX_DPAD, SWITCH_HAT_DOWN}},
+    {"dpad_left", {BUTTON_INDEX_DPAD, SWITCH_HAT_LEFT}},
+    {"dpad_right", {BUTTON_INDEX_DPAD, SWITCH_HAT_RIGHT}},
+};
+
+constexpr size_t ENTRY_COUNT = sizeof(ENTRIES) / sizeof(ENTRIES[0]);
+constexpr uint32_t SLOT_BITS = 5;
+constexpr uint32_t SLOT_COUNT = 1u << SLOT_BITS;
+static_assert(ENTRY_COUNT < SLOT_COUNT, "Button table needs more slots");
+
+constexpr char to_lower(char c) { return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c; }
+constexpr char to_upper(char c) { return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c; }
+
+constexpr size_t name_length(const char *name) {
+  size_t len = 0;
+  while (name[len]) len++;
+  return len;
+}
+
+// FNV-1a over the lower-cased name, mixed with the seed and folded to a slot
+constexpr uint32_t hash(const char *name, size_t len, uint32_t seed) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (uint8_t)to_lower(name[i])) * 16777619u;
+  }
+  return ((h ^ seed) * 2654435761u) >> (32 - SLOT_BITS);
+}
+
+constexpr bool seed_is_perfect(uint32_t seed) {
+  bool used[SLOT_COUNT] = {};
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    uint32_t slot = hash(ENTRIES[i].name, name_length(ENTRIES[i].name), seed);
+    if (used[slot]) return false;
+    used[slot] = true;
+  }
+  return true;
+}
+
+constexpr uint32_t find_seed() {
+  for (uint32_t seed = 1; seed < 100000; seed++) {
+    if (seed_is_perfect(seed)) return seed;
+  }
+  return 0;
+}
+
+constexpr uint32_t SEED = find_seed();
+static_assert(SEED != 0, "No perfect hash seed found for the button table");
+
+// Slot -> entry index + 1 (0 marks an empty slot)
+struct SlotTable {
+  uint8_t entry[SLOT_COUNT];
+};
+
+constexpr SlotTable build_slots() {
+  SlotTable table = {};
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    table.entry[hash(ENTRIES[i].name, name_length(ENTRIES[i].name), SEED)] = i + 1;
+  }
+  return table;
+}
+
+constexpr SlotTable SLOTS = build_slots();
+
+// Resolve a (not necessarily terminated) name of len characters
+inline bool lookup(const char *name, size_t len, ButtonMask &button) {
+  uint8_t entry = SLOTS.entry[hash(name, len, SEED)];
+  if (entry == 0) return false;
+
+  const Entry &candidate = ENTRIES[entry - 1];
+  for (size_t i = 0; i < len; i++) {
+    if (candidate.name[i] != to_lower(name[i])) return false;
+  }
+  if (candidate.name[len] != '\0') return false;
+
+  button = candidate.button;
+  return true;
+}
+
+// Sticks are matched on their first letter ("l_stick", "left", ...)
+inline bool lookup_stick(const char *name, size_t len, uint8_t &stick) {
+  if (len == 0) return false;
+  char c = to_lower(name[0]);
+  if (c == 'l') {
+    stick = STICK_LEFT;
+  } else if (c == 'r') {
+    stick = STICK_RIGHT;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// D-pad direction bitmap -> HAT nibble, opposite directions cancel out
+struct HatTable {
+  uint8_t hat[16];
+};
+
+constexpr HatTable build_hat_table() {
+  HatTable table = {};
+  for (uint8_t dirs = 0; dirs < 16; dirs++) {
+    uint8_t hat = dirs;
+    if ((hat & SWITCH_HAT_UP) && (hat & SWITCH_HAT_DOWN)) hat &= ~(SWITCH_HAT_UP | SWITCH_HAT_DOWN);
+    if ((hat & SWITCH_HAT_LEFT) && (hat & SWITCH_HAT_RIGHT)) hat &= ~(SWITCH_HAT_LEFT | SWITCH_HAT_RIGHT);
+    table.hat[dirs] = hat;
+  }
+  return table;
+}
+
+constexpr HatTable DPAD_TO_HAT = build_hat_table();
+static_assert(DPAD_TO_HAT.hat[SWITCH_HAT_UP | SWITCH_HAT_RIGHT] == SWITCH_HAT_UPRIGHT, "HAT encoding mismatch");
+static_assert(DPAD_TO_HAT.hat[SWITCH_HAT_DOWN | SWITCH_HAT_LEFT] == SWITCH_HAT_DOWNLEFT, "HAT encoding mismatch");
+
+}  // namespace ButtonTable
+
+#endif
@@ -1,36 +1,94 @@
 #ifndef CommandParser_h
 #define CommandParser_h
 
+#include "MacroAssembler.h"
+#include "MacroStore.h"
 #include "SwitchBluetooth.h"
 
 class CommandParser {
 public:
-    CommandParser(SwitchBluetooth* switch_controller);
+    CommandParser(SwitchBluetooth* switch_controller, MacroStore* macro_store);
     
-    // Parse and execute a command line
-    bool parse_and_execute(const char* command_line);
+    // Why a line was rejected. Besides the log text, each rejected line is
+    // answered with "ERR <code> <line>", where line numbers every non-empty
+    // line received since boot, starting at 1.
+    enum Error : uint8_t {
+        ERROR_NONE,
+        ERROR_UNKNOWN_COMMAND,
+        ERROR_UNKNOWN_BUTTON,   // Unknown button or stick name
+        ERROR_BAD_ARGUMENT,     // Missing, malformed, out of range or extra arguments
+        ERROR_TIMELINE_FULL,
+        ERROR_REJECTED,         // Well formed but refused: no macro, a full buffer, ...
+        ERROR_LINE_TOO_LONG,    // Longer than SerialInput::MAX_LINE, dropped unread
+    };
     
-    // Check if currently in a sleep state (non-blocking)
-    bool is_sleeping();
-    void update_sleep_state();
+    // Parse and execute a command line whose first byte arrived at received_us
+    Error parse_and_execute(const char* command_line, uint32_t received_us);
+    
+    // Answer a line that never reached the parser
+    void reject_line(Error error);
+    
+    // Most timeline events a single command line can schedule
+    static constexpr uint32_t MAX_EVENTS_PER_LINE = 32;
+
+    // Transmitted frames PRESS holds its buttons for unless given ("PRESS a 5f")
+    static constexpr uint32_t DEFAULT_PRESS_FRAMES = 3;
+    static constexpr uint32_t MAX_PRESS_FRAMES = 255;
+
+    // Longest ramp or period a stick motion can have
+    static constexpr uint32_t MAX_MOTION_FRAMES = 0xFFFF;
+
+    // IMU samples one line can carry
+    static constexpr uint32_t MAX_IMU_SAMPLES_PER_LINE = 32;
+    
+    // A word of the line, used where it lies instead of being copied out
+    struct Token {
+        const char* start;
+        size_t length;
+        // Case-insensitive match against an upper-case word
+        bool is(const char* word) const;
+    };
+    
+    // Utility functions, shared with the macro assembler
+    static void skip_whitespace(const char*& ptr);
+    static bool at_end(const char*& ptr);  // Only whitespace left
+    // Next word and the whitespace after it; false at the end of the line
+    static bool next_token(const char*& ptr, Token& token);
+    // Decimal numbers in fixed point: value is scaled by 10^decimals
+    // (at most 6) and extra fraction digits are dropped
+    static bool parse_fixed(const char*& ptr, int32_t& value, uint8_t decimals);
+    static bool parse_seconds_us(const char*& ptr, uint64_t& us);
+    static bool parse_uint(const char*& ptr, uint32_t& value);
+    static bool parse_hex_uint(const char*& ptr, uint32_t& value);
+    static bool parse_hex_bytes(const char*& ptr, uint8_t* data, size_t capacity, size_t& length);
+    static bool parse_press_frames(const char* args, uint32_t& frames);
     
 private:
     SwitchBluetooth* _switch;
+    MacroStore* _store;
+    uint32_t _lines = 0;  // Lines received, for error replies
     
-    // Non-blocking sleep state
-    bool _sleep_active = false;
-    uint32_t _sleep_end_time = 0;
+    // Text macros are assembled here; bytecode macros run straight from flash
+    static constexpr uint32_t PROGRAM_WORDS = 2048;
+    MacroAssembler _assembler;
+    uint32_t _program[PROGRAM_WORDS];
     
     // Command parsing helpers
-    bool parse_button_command(const char* args, bool pressed);
-    bool parse_press_command(const char* args);  // Press and release with timing
-    bool parse_stick_command(const char* args);
-    bool parse_sleep_command(const char* args);
-    
-    // Utility functions
-    void skip_whitespace(const char*& ptr);
-    bool parse_float(const char*& ptr, float& value);
-    bool parse_button_name(const char*& ptr, char* button_name, size_t max_len);
+    Error execute(const char* command_line);
+    Error parse_buttons(const char*& ptr, uint8_t* masks);
+    Error schedule_buttons(const uint8_t* masks, bool pressed, uint8_t after_frames);
+    Error parse_button_command(const char* args, bool pressed);
+    Error parse_press_command(const char* args);  // Press and release with timing
+    Error parse_stick_command(const char* args);
+    Error parse_stick_motion_command(uint8_t motion, const char* args);
+    Error parse_sleep_command(const char* args);
+    Error parse_upload_command(const char* args);
+    Error parse_run_command(const char* args);
+    Error parse_spi_write_command(const char* args);
+    Error parse_imu_command(const char* args);
+    Error stop_command();
+    Error stats_command(const char* args);
+    Error bootstats_command();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -2,26 +2,91 @@
 #define FastLogger_h
 
 #include <stdint.h>
+#include "LogMessages.h"
+#include "hardware/sync.h"
 
+// Send the log as binary frames for host/log_decode instead of text
+#ifndef SWITCH_BINARY_LOG
+#define SWITCH_BINARY_LOG 0
+#endif
+
+// Non-blocking log ring. Producers on either core (or in an IRQ) reserve
+// space for a record under a hardware spinlock held only for the index
+// update, copy their text outside the lock and then mark the record
+// committed. flush_logs drains committed records in order, writing only
+// what the USB CDC TX FIFO can take without blocking.
+//
+// log_event records only a message ID, a timestamp and the argument words;
+// formatting is deferred to flush time (or to the host in binary mode), so
+// hot paths never run printf.
 class FastLogger {
 public:
     static void init();
     static void log(const char* message);
     static void log_fmt(const char* format, ...);
-    static void flush_logs();
+    static void log_event(LogId id, uint32_t arg0 = 0, uint32_t arg1 = 0, uint32_t arg2 = 0,
+                          uint32_t arg3 = 0);
+
+    // Logs a message from LogMessages.h, or compiles to nothing if the
+    // build's log level for its subsystem excludes it
+    template <LogId id, typename... Args>
+    static void log_event(Args... args) {
+        if constexpr (log_enabled(id)) {
+            log_event(id, static_cast<uint32_t>(args)...);
+        }
+    }
+
+    // Free-form text under the same policy: if the build's log level for
+    // subsystem excludes level, the call and its text compile to nothing.
+    // Firmware code logs text only through these.
+    template <LogSubsystem subsystem, LogLevel level>
+    static void log(const char* message) {
+        if constexpr (log_enabled(subsystem, level)) {
+            log(message);
+        }
+    }
+    template <LogSubsystem subsystem, LogLevel level, typename... Args>
+    static void log_fmt(const char* format, Args... args) {
+        if constexpr (log_enabled(subsystem, level)) {
+            log_fmt(format, args...);
+        }
+    }
+    static void flush_logs(uint32_t budget_us = FLUSH_BUDGET_US);
     static bool has_pending_logs();
-    
+
+    // Messages dropped because the ring was full, and the most bytes ever queued
+    static uint32_t dropped_count() { return dropped; }
+    static uint32_t high_water() { return high_water_mark; }
+
+    static constexpr uint32_t FLUSH_BUDGET_US = 200;
+
 private:
-    static constexpr int BUFFER_SIZE = 2048;
+    static constexpr uint32_t BUFFER_SIZE = SWITCH_CONFIG.log_buffer_size;
     static constexpr int MAX_MESSAGE_LEN = 128;
-    
-    static char log_buffer[BUFFER_SIZE];
-    static volatile int write_pos;
-    static volatile int read_pos;
-    static volatile bool buffer_full;
-    
-    static void add_message(const char* message);
-    static bool get_next_message(char* output, int max_len);
+
+    // Record header word: payload length, EVENT for log_event records and
+    // COMMITTED once the payload is in place. Records are word aligned so a
+    // header never wraps.
+    static constexpr uint32_t COMMITTED = 0x80000000u;
+    static constexpr uint32_t EVENT = 0x40000000u;
+    static constexpr uint32_t LENGTH_MASK = 0xFFFF;
+
+    // Event payload: id (u16), padding (u16), timestamp (u32), arguments
+    static constexpr uint32_t EVENT_HEADER_SIZE = 8;
+
+    static uint32_t log_buffer[BUFFER_SIZE / 4];
+    static volatile uint32_t reserve_pos;  // Free-running byte counters
+    static volatile uint32_t read_pos;
+    static volatile uint32_t dropped;
+    static volatile uint32_t high_water_mark;
+    static spin_lock_t* reserve_lock;
+
+    static void add_message(const char* message, int length);
+    static bool reserve(uint32_t header, uint32_t& pos);
+    static void commit(uint32_t pos, uint32_t header);
+    static int render(uint32_t pos, uint32_t header, char* out);
+    static void copy_in(uint32_t pos, const void* data, uint32_t length);
+    static void copy_out(uint32_t pos, void* data, uint32_t length);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,48 @@
+#ifndef Histogram_h
+#define Histogram_h
+
+#include <stdint.h>
+
+// Fixed-bucket log-scale histogram of microsecond values. Values below 8
+// get a bucket each; above that every power of two is split into four
+// buckets, so a percentile is accurate to within 25%. Values above about
+// 7 s share the last bucket; the exact maximum is kept separately.
+//
+// Single writer. A reader on the other core may see a sample half
+// recorded, which only skews one dump.
+class Histogram {
+public:
+    static constexpr int BUCKETS = 88;
+
+    void record(uint32_t value) {
+        _counts[bucket(value)]++;
+        _count++;
+        if (value > _max) {
+            _max = value;
+        }
+    }
+    void reset();
+
+    uint32_t count() const { return _count; }
+    uint32_t max() const { return _max; }
+
+    // Upper bound of the bucket holding the given percentile, 0 if empty
+    uint32_t percentile(uint32_t percent) const;
+
+private:
+    static int bucket(uint32_t value) {
+        if (value < 8) {
+            return value;
+        }
+        int exponent = 31 - __builtin_clz(value);
+        int index = 8 + (exponent - 3) * 4 + ((value >> (exponent - 2)) & 3);
+        return index < BUCKETS ? index : BUCKETS - 1;
+    }
+    static uint32_t bucket_max(int index);
+
+    uint32_t _counts[BUCKETS] = {0};
+    uint32_t _count = 0;
+    uint32_t _max = 0;
+};
+
+#endif
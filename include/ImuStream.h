@@ -0,0 +1,47 @@
+#ifndef ImuStream_h
+#define ImuStream_h
+
+#include <stdint.h>
+
+#include "SwitchConfig.h"
+
+// Accelerometer and gyro samples streamed by the host for motion controls.
+// Samples arrive in the report's wire layout (accel x, y, z then gyro x, y,
+// z as little-endian int16) and are written straight into their place in a
+// frame of three, so each full input report only copies one finished frame.
+// When the host falls behind, the last sample is repeated.
+//
+// The ring is single-producer/single-consumer and lock-free like Timeline:
+// the command parser pushes and the HID send path pops.
+class ImuStream {
+public:
+    static constexpr uint32_t SAMPLE_SIZE = 12;
+    static constexpr uint32_t SAMPLES_PER_FRAME = 3;
+    static constexpr uint32_t FRAME_SIZE = SAMPLE_SIZE * SAMPLES_PER_FRAME;
+    static constexpr uint32_t CAPACITY = SWITCH_CONFIG.imu_frames;
+
+    ImuStream();
+
+    // Producer side (command parser)
+    bool push(const uint8_t* samples, uint32_t count);
+    uint32_t free_samples() { return (CAPACITY - (_written - _read)) * SAMPLES_PER_FRAME - _slot; }
+
+    // Consumer side (full input report): copy the next frame into the report
+    void pop_frame(uint8_t* out);
+
+    // Frames sent without fresh samples since streaming started, zero unless
+    // SWITCH_CONFIG.trace
+    uint32_t underruns() { return _underruns; }
+    void reset_stats() { _underruns = 0; }
+
+private:
+    uint8_t _frames[CAPACITY][FRAME_SIZE];
+    volatile uint32_t _written = 0;  // Free-running count of frames completed
+    volatile uint32_t _read = 0;     // Free-running count of frames popped
+    uint32_t _slot = 0;              // Samples already in the frame being filled
+    bool _streaming = false;         // Consumer side: a frame has been sent
+    uint8_t _last[SAMPLE_SIZE];      // Repeated on underrun
+    uint32_t _underruns = 0;
+};
+
+#endif
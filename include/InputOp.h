@@ -0,0 +1,52 @@
+#ifndef InputOp_h
+#define InputOp_h
+
+#include <stdint.h>
+
+#include "ButtonTable.h"
+
+// A single controller state change, resolved once at parse time
+struct InputOp {
+  enum Type : uint8_t { BUTTON_SET, BUTTON_CLEAR, STICK_SET, STICK_MOTION } type;
+  uint8_t index;    // Button byte (or BUTTON_INDEX_DPAD), or STICK_LEFT/STICK_RIGHT
+  uint8_t mask;     // Button mask, or StickMotion::Kind; unused for STICK_SET
+  uint16_t h, v;    // 12-bit stick position, or motion target/amplitudes
+  uint16_t frames;  // Motion length or period
+
+  static InputOp button(ButtonMask button, bool pressed) {
+    InputOp op = {pressed ? BUTTON_SET : BUTTON_CLEAR, button.index, button.mask, 0, 0, 0};
+    return op;
+  }
+
+  // Stick values are fixed point with STICK_DECIMALS decimals, so 1.0 is
+  // STICK_UNIT; nothing on the input path needs float math
+  static constexpr uint8_t STICK_DECIMALS = 4;
+  static constexpr int32_t STICK_UNIT = 10000;
+
+  static InputOp stick(uint8_t stick, int32_t h, int32_t v) {
+    InputOp op = {STICK_SET, stick, 0, stick_axis_to_raw(h), stick_axis_to_raw(v), 0};
+    return op;
+  }
+
+  // Played by StickMotion rather than the input queue
+  static InputOp stick_motion(uint8_t stick, uint8_t kind, uint16_t h, uint16_t v, uint16_t frames) {
+    InputOp op = {STICK_MOTION, stick, kind, h, v, frames};
+    return op;
+  }
+
+  // Convert from [-STICK_UNIT, STICK_UNIT] to [0x000, 0xFFF] range
+  static uint16_t stick_axis_to_raw(int32_t value) {
+    if (value < -STICK_UNIT) value = -STICK_UNIT;
+    if (value > STICK_UNIT) value = STICK_UNIT;
+    return (uint16_t)((value + STICK_UNIT) * SWITCH_JOYSTICK_MID / STICK_UNIT);
+  }
+
+  // Convert a distance from the centre in [0, STICK_UNIT] to raw units
+  static uint16_t stick_offset_to_raw(int32_t value) {
+    if (value < 0) value = -value;
+    if (value > STICK_UNIT) value = STICK_UNIT;
+    return (uint16_t)(value * SWITCH_JOYSTICK_MID / STICK_UNIT);
+  }
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef InputQueue_h
+#define InputQueue_h
+
+#include <stdint.h>
+
+#include "InputOp.h"
+#include "SwitchConfig.h"
+#include "SwitchConsts.h"
+
+// Pending controller writes for the next HID frame, keyed per button and per
+// stick. A later write to the same control overwrites the pending one, so
+// memory is bounded by the number of controls and nothing is ever dropped.
+//
+// Frame ordering is kept with step boundaries: after mark_boundary(), a
+// control that was already written earlier in this frame refuses new writes
+// until apply() has moved the earlier value into the report.
+class InputQueue {
+public:
+    void reset();
+
+    bool push(const InputOp& op);
+    void mark_boundary();
+    bool is_empty() { return _pending_count == 0; }
+
+    // Apply pending writes to the report and start a new frame; returns how
+    // many controls changed
+    int apply(SwitchReport& report, uint8_t& dpad);
+
+    // Pending writes laid over a copy of the report, keeping the frame open
+    void preview(SwitchReport& report, uint8_t dpad) const;
+
+    // Writes merged into a pending one, and controls applied; zero unless
+    // SWITCH_CONFIG.trace
+    uint32_t coalesced_count() { return _coalesced; }
+    uint32_t applied_count() { return _applied; }
+    void reset_stats() {
+        _coalesced = 0;
+        _applied = 0;
+    }
+
+private:
+    static constexpr int BUTTON_BYTES = BUTTON_INDEX_DPAD + 1;
+    static constexpr int STICK_COUNT = 2;
+
+    // Pending press/release masks per button byte, d-pad bitmap last
+    uint8_t _set[BUTTON_BYTES] = {0};
+    uint8_t _clear[BUTTON_BYTES] = {0};
+    uint16_t _stick_h[STICK_COUNT] = {0};
+    uint16_t _stick_v[STICK_COUNT] = {0};
+    uint8_t _stick_pending = 0;
+
+    // Controls written this frame, and within the current step of it
+    uint8_t _frame_buttons[BUTTON_BYTES] = {0};
+    uint8_t _step_buttons[BUTTON_BYTES] = {0};
+    uint8_t _step_sticks = 0;
+
+    int _pending_count = 0;
+    uint32_t _coalesced = 0;
+    uint32_t _applied = 0;
+
+    void write_pending(SwitchReport& report, uint8_t& dpad) const;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef LogMessages_h
+#define LogMessages_h
+
+#include <stdint.h>
+
+#include "SwitchConfig.h"
+
+// Messages logged by ID. The firmware stores only the ID, a timestamp and
+// the raw argument words; the format string is applied when the log is
+// flushed as text, or by the host decoder (host/log_decode) in binary mode.
+// Formats take up to four integer arguments (%d, %u, %x with optional
+// width); free-form text still goes through FastLogger::log/log_fmt.
+// Each message belongs to a subsystem and level, and is compiled out when
+// the build's SwitchConfig threshold for that subsystem is lower.
+// Append new messages at the end so decoders built from older firmware
+// keep working.
+#define LOG_MESSAGES(X)                                                                    \
+  X(CONSOLIDATED, LOG_HID, LOG_DEBUG, "Consolidated %d commands into single frame")        \
+  X(TIMELINE_FULL_BUTTON, LOG_PARSER, LOG_ERROR, "Timeline full - dropping button command") \
+  X(TIMELINE_FULL_STICK, LOG_PARSER, LOG_ERROR, "Timeline full - dropping stick command")   \
+  X(SUBCOMMAND_QUEUE_FULL, LOG_HID, LOG_ERROR, "Subcommand queue full - dropping request") \
+  X(SWITCH_CONNECTED, LOG_HID, LOG_INFO, "Switch connected - ready for commands")          \
+  X(SWITCH_DISCONNECTED, LOG_HID, LOG_INFO, "Switch disconnected")                         \
+  X(CONNECTION_FAILED, LOG_HID, LOG_ERROR, "Connection failed")                            \
+  X(RUNNING_MACRO, LOG_MACRO, LOG_INFO, "Running macro %u (%u instructions)")              \
+  X(NO_MACRO, LOG_MACRO, LOG_REPLY, "No macro in slot %u")                                 \
+  X(MACRO_FINISHED, LOG_MACRO, LOG_INFO, "Macro finished")                                 \
+  X(MACRO_CORRUPTED, LOG_STORE, LOG_ERROR, "Macro slot %u is corrupted")                   \
+  X(UPLOAD_READY, LOG_STORE, LOG_REPLY, "READY %u %u")                                     \
+  X(UPLOAD_ACK, LOG_STORE, LOG_REPLY, "ACK %u")                                            \
+  X(UPLOAD_NAK_LENGTH, LOG_STORE, LOG_REPLY, "NAK %u LENGTH")                              \
+  X(UPLOAD_NAK_CRC, LOG_STORE, LOG_REPLY, "NAK %u CRC")                                    \
+  X(UPLOAD_NAK_OFFSET, LOG_STORE, LOG_REPLY, "NAK %u OFFSET")                              \
+  X(UPLOAD_DONE, LOG_STORE, LOG_REPLY, "DONE %u %u %08x")                                  \
+  X(STORE_SLOT, LOG_STORE, LOG_REPLY, "SLOT %d %u bytes")                                  \
+  X(STORE_FREE, LOG_STORE, LOG_REPLY, "FREE %u bytes")                                     \
+  X(SUBCOMMAND, LOG_HID, LOG_DEBUG, "Subcommand %02x")                                     \
+  X(RUMBLE_LEFT, LOG_HID, LOG_REPLY, "RUMBLE L %u %u %u %u")                               \
+  X(RUMBLE_RIGHT, LOG_HID, LOG_REPLY, "RUMBLE R %u %u %u %u")                              \
+  X(RECONNECTING, LOG_HID, LOG_INFO, "Reconnecting to the last console")                    \
+  X(RECONNECT_FAILED, LOG_HID, LOG_ERROR, "Reconnect failed (status %02x)")                \
+  X(FIRST_REPORT, LOG_HID, LOG_INFO, "Connected after %u ms, first input report after %u ms") \
+  X(LINE_TOO_LONG, LOG_PARSER, LOG_ERROR, "Line longer than %u characters - dropped")  \
+  X(COMMAND_ERROR, LOG_PARSER, LOG_REPLY, "ERR %u %u")
+
+enum LogId : uint16_t {
+#define LOG_MESSAGE_ID(id, subsystem, level, format) LOG_##id,
+  LOG_MESSAGES(LOG_MESSAGE_ID)
+#undef LOG_MESSAGE_ID
+  LOG_COUNT
+};
+
+// Binary log frames:
+//   LOG_FRAME_SYNC | payload length (u8) | id (u16 LE) | timestamp us (u32 LE) | args (u32 LE each)
+// Free-form text is sent with id LOG_TEXT_ID followed by the characters.
+constexpr uint8_t LOG_FRAME_SYNC = 0xA5;
+constexpr uint16_t LOG_TEXT_ID = 0xFFFF;
+constexpr int LOG_MAX_ARGS = 4;
+
+constexpr const char *LOG_FORMATS[] = {
+#define LOG_MESSAGE_FORMAT(id, subsystem, level, format) format,
+    LOG_MESSAGES(LOG_MESSAGE_FORMAT)
+#undef LOG_MESSAGE_FORMAT
+};
+
+// Argument count of a format, counted once by the compiler
+constexpr uint8_t log_format_args(const char *format) {
+  uint8_t count = 0;
+  for (; *format; format++) {
+    if (format[0] == '%') {
+      if (format[1] == '%') {
+        format++;
+      } else {
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+struct LogArgCounts {
+  uint8_t count[LOG_COUNT];
+};
+
+constexpr LogArgCounts build_log_arg_counts() {
+  LogArgCounts counts = {};
+  for (int i = 0; i < LOG_COUNT; i++) {
+    counts.count[i] = log_format_args(LOG_FORMATS[i]);
+  }
+  return counts;
+}
+
+constexpr LogArgCounts LOG_ARG_COUNTS = build_log_arg_counts();
+
+constexpr bool log_args_fit() {
+  for (int i = 0; i < LOG_COUNT; i++) {
+    if (LOG_ARG_COUNTS.count[i] > LOG_MAX_ARGS) {
+      return false;
+    }
+  }
+  return true;
+}
+static_assert(log_args_fit(), "Logged messages take at most LOG_MAX_ARGS arguments");
+
+// Whether messages of a subsystem and level are compiled into this build
+constexpr bool log_enabled(LogSubsystem subsystem, LogLevel level) {
+  return level <= SWITCH_CONFIG.log_level[subsystem];
+}
+
+// Whether a message is compiled into this build
+constexpr bool log_enabled(LogId id) {
+  constexpr LogSubsystem subsystems[] = {
+#define LOG_MESSAGE_SUBSYSTEM(id, subsystem, level, format) subsystem,
+      LOG_MESSAGES(LOG_MESSAGE_SUBSYSTEM)
+#undef LOG_MESSAGE_SUBSYSTEM
+  };
+  constexpr LogLevel levels[] = {
+#define LOG_MESSAGE_LEVEL(id, subsystem, level, format) level,
+      LOG_MESSAGES(LOG_MESSAGE_LEVEL)
+#undef LOG_MESSAGE_LEVEL
+  };
+  return log_enabled(subsystems[id], levels[id]);
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef MacroAssembler_h
+#define MacroAssembler_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "MacroVM.h"
+
+// Translates macro text into MacroVM bytecode. Besides the serial commands
+// (PRESS, HOLD, RELEASE, STICK, SLEEP) a macro can use:
+//   LOOP [count] ... ENDLOOP   count 0 or omitted repeats forever
+//   <label>:  /  JUMP <label>
+//   SET <counter> <value>, INC <counter>, DEC <counter>, JNZ <counter> <label>
+//   HALT
+// Counters are c0-c7. Button names and stick values are resolved here, so
+// the VM never touches text.
+class MacroAssembler {
+public:
+    static constexpr int MAX_LABELS = 32;
+    static constexpr int MAX_FIXUPS = 64;
+    static constexpr int LABEL_LEN = 16;  // Including the terminator
+    static constexpr int LINE_LEN = 128;  // Including the terminator
+
+    // Returns the program length in words, or 0 after logging the first error
+    uint32_t assemble(const char* text, uint32_t length, uint32_t* code, uint32_t capacity);
+
+private:
+    struct Label {
+        char name[LABEL_LEN];
+        uint32_t target;
+        bool defined;
+    };
+    struct Fixup {
+        uint32_t at;
+        uint8_t label;
+    };
+
+    uint32_t* _code;
+    uint32_t _capacity;
+    uint32_t _count;
+    uint32_t _line;
+    int _loop_depth;
+    Label _labels[MAX_LABELS];
+    int _label_count;
+    Fixup _fixups[MAX_FIXUPS];
+    int _fixup_count;
+
+    // Instructions read their operands from ptr and leave it after them
+    bool assemble_line(const char* line);
+    bool assemble_instruction(const char* command, size_t length, const char*& ptr);
+    bool assemble_buttons(const char*& ptr, MacroVM::Opcode op);
+    bool assemble_stick(const char*& ptr);
+    bool assemble_sleep(const char*& ptr);
+    bool assemble_branch(const char*& ptr, MacroVM::Opcode op, uint8_t counter);
+    bool parse_counter(const char*& ptr, uint8_t& counter);
+    int find_label(const char* name, size_t length);  // Creates unknown labels
+    bool emit(uint32_t word);
+    bool error(const char* message);
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef MacroStore_h
+#define MacroStore_h
+
+#include <stdint.h>
+
+// Log-structured macro storage in the flash space between the firmware image
+// and BTstack's TLV flash bank. Every upload appends a record; the newest
+// committed record for a slot wins. Uploads arrive as binary chunks, each
+// with its own CRC32 and an ACK/NAK reply, and are written a page at a time.
+// The sectors a record needs are erased before READY, one per poll(), so no
+// erase lands in the middle of receiving.
+//
+// Chunk framing after "UPLOAD <slot> <length>":
+//   0xC5 | offset (u32 LE) | length (u16 LE) | crc32 of data (u32 LE) | data
+// A chunk for an offset that was already accepted is acknowledged again
+// without being written, so the host can resend after a lost ACK.
+class MacroStore {
+public:
+    static constexpr uint8_t MAX_SLOTS = 16;
+    static constexpr uint32_t STORE_SIZE = 256 * 1024;
+    static constexpr uint16_t MAX_CHUNK = 1024;
+    static constexpr uint8_t CHUNK_SYNC = 0xC5;
+    static constexpr uint32_t RECEIVE_TIMEOUT_US = 1000000;
+
+    void init();
+
+    // Upload. READY is logged once poll() has erased the record's sectors.
+    bool begin_upload(uint32_t slot, uint32_t length);
+    void receive(uint8_t byte);
+    void poll();
+    bool is_receiving() { return _receiving; }
+    bool is_preparing() { return _preparing; }
+
+    // Lookup of the newest committed copy of a slot
+    bool find(uint32_t slot, const uint8_t*& data, uint32_t& length);
+    void list();
+
+    // Empties the store. Sectors are erased one per poll() so the radio and
+    // the other core are never held off for longer than a single erase;
+    // uploads are refused until "ERASED" is logged.
+    void erase_all();
+    bool is_erasing() { return _erase_pos > 0; }
+
+    static uint32_t crc32(const uint8_t* data, uint32_t length, uint32_t crc = 0);
+
+private:
+    struct RecordHeader {
+        uint32_t magic;
+        uint32_t state;      // Erased while uploading, cleared on commit
+        uint32_t length;
+        uint32_t length_check;  // ~length, rejects garbage headers
+        uint32_t crc;
+        uint8_t slot;
+        uint8_t reserved[3];
+    };
+
+    enum ReceiveState : uint8_t { SYNC, OFFSET, LENGTH, CRC, DATA };
+
+    bool _available = false;     // Clear of the firmware image
+
+    // Offsets of each slot's newest record within the store
+    uint32_t _slot_offset[MAX_SLOTS];
+    uint32_t _log_end = 0;       // First free page
+    uint32_t _erased_until = 0;  // End of the last sector erased for the log
+    uint32_t _erase_pos = 0;     // End of the sectors erase_all still has to erase
+
+    // Upload in progress
+    bool _preparing = false;       // Erasing ahead of the record
+    bool _receiving = false;
+    uint8_t _upload_slot = 0;
+    uint32_t _upload_offset = 0;   // Record header page
+    uint32_t _upload_length = 0;
+    uint32_t _received = 0;
+    uint32_t _write_offset = 0;    // Next data page
+    uint16_t _page_fill = 0;
+    uint32_t _upload_crc = 0;
+    uint64_t _last_byte_us = 0;
+
+    ReceiveState _state = SYNC;
+    uint16_t _field_pos = 0;
+    uint32_t _chunk_offset = 0;
+    uint16_t _chunk_length = 0;
+    uint32_t _chunk_crc = 0;
+    uint8_t _chunk[MAX_CHUNK];
+    uint8_t _page[256];
+
+    void scan();
+    const RecordHeader* header_at(uint32_t offset);
+    void end_chunk();
+    bool append(const uint8_t* data, uint32_t length);
+    bool program_page(uint32_t offset, const uint8_t* data);
+    bool erase_sector(uint32_t offset);
+    void start_receiving();
+    bool finish_upload();
+    void abort_upload(const char* reason);
+};
+
+#endif
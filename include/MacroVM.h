@@ -0,0 +1,86 @@
+#ifndef MacroVM_h
+#define MacroVM_h
+
+#include <stdint.h>
+
+#include "InputQueue.h"
+#include "StickMotion.h"
+
+// Interpreter for compact macro bytecode. Every instruction is one 32-bit
+// word: the opcode in the low byte and either a 24-bit operand or an 8-bit
+// register/index plus a 16-bit value above it. Decoding is a single switch
+// on the opcode, so every instruction costs a fixed number of cycles.
+//
+// SwitchBluetooth runs the program once per HID frame until it waits, so a
+// program with loops can run forever without any serial traffic.
+class MacroVM {
+public:
+    enum Opcode : uint8_t {
+        OP_HALT,
+        OP_BUTTON_DOWN,  // a = button byte, b = mask
+        OP_BUTTON_UP,
+        OP_STICK_L,      // operand = h | v << 12
+        OP_STICK_R,
+        OP_WAIT_US,      // operand = microseconds
+        OP_WAIT_MS,      // operand = milliseconds
+        OP_WAIT_FRAMES,  // operand = HID frames
+        OP_LOOP,         // operand = iterations, 0 = forever
+        OP_ENDLOOP,
+        OP_JUMP,         // operand = instruction index
+        OP_SET,          // a = counter, b = value
+        OP_INC,          // a = counter
+        OP_DEC,          // a = counter
+        OP_JNZ,          // a = counter, b = instruction index
+        OP_COUNT
+    };
+
+    // First word of every program ("SWBC")
+    static constexpr uint32_t MAGIC = 0x43425753;
+    static constexpr int COUNTERS = 8;
+    static constexpr int LOOP_DEPTH = 8;
+    static constexpr int STEPS_PER_FRAME = 64;
+
+    static constexpr uint32_t encode(Opcode op, uint32_t operand = 0) {
+        return op | (operand << 8);
+    }
+    static constexpr uint32_t encode(Opcode op, uint8_t a, uint16_t b) {
+        return op | ((uint32_t)a << 8) | ((uint32_t)b << 16);
+    }
+
+    // Program words include the magic; runs is the number of passes, 0 = forever
+    bool start(const uint32_t* program, uint32_t words, uint32_t runs);
+    void stop();
+    bool is_running() { return _running; }
+
+    // Execute until the program waits; ops go straight into the frame's queue.
+    // Setting a stick ends any motion running on it, as a STICK line does.
+    void run_frame(uint64_t now_us, uint32_t frame, InputQueue& queue, StickMotion& motion);
+
+private:
+    struct Loop {
+        uint32_t start;
+        uint32_t remaining;  // 0 = forever
+    };
+
+    const uint32_t* _code = nullptr;
+    uint32_t _length = 0;
+    uint32_t _pc = 0;
+    uint32_t _runs = 0;
+    uint32_t _counters[COUNTERS];
+    Loop _loops[LOOP_DEPTH];
+    uint8_t _loop_depth = 0;
+
+    // Waits are measured from the previous deadline so long programs don't drift
+    uint64_t _clock_us = 0;
+    uint32_t _wait_frame = 0;
+    bool _waiting_frames = false;
+    bool _clock_started = false;
+
+    // Handshake so stop() never returns while a frame is executing
+    volatile bool _running = false;
+    volatile bool _busy = false;
+
+    void fault(const char* reason);
+};
+
+#endif
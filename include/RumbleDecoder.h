@@ -0,0 +1,39 @@
+#ifndef RumbleDecoder_h
+#define RumbleDecoder_h
+
+#include <stdint.h>
+
+// Decodes the HD rumble data the console puts in every 0x01 and 0x10 output
+// report: four bytes per side, holding a high and a low band, each with a
+// frequency and an amplitude. Changes go to the host as RUMBLE log events,
+// so automation can react to a rumble cue (a bite, a hit) within a few
+// milliseconds instead of waiting on video capture.
+//
+// Rumble starting or stopping is reported at once. Any other change waits
+// until HOLDOFF_US after the previous event on that side. The console
+// resends the full state in every report, so the latest state always goes
+// out on the first report after the holdoff.
+class RumbleDecoder {
+public:
+    static constexpr uint32_t HOLDOFF_US = 20000;
+    static constexpr int DATA_SIZE = 8;  // Left side then right
+
+    struct State {
+        uint16_t hf_hz;
+        uint16_t lf_hz;
+        uint8_t hf_amp;  // Encoded amplitude, 0 (silent) to about 100
+        uint8_t lf_amp;
+    };
+
+    static State decode(const uint8_t* side);
+
+    void reset();
+    void update(const uint8_t* data, uint32_t now_us);
+    const State& state(uint8_t side) { return _sent[side]; }
+
+private:
+    State _sent[2];
+    uint32_t _sent_us[2];
+};
+
+#endif
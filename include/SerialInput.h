@@ -0,0 +1,70 @@
+#ifndef SerialInput_h
+#define SerialInput_h
+
+#include <stdint.h>
+
+#include "SwitchConfig.h"
+
+// USB CDC receive path. receive() moves everything the CDC FIFO holds, up
+// to a byte budget, into a ring with bulk reads instead of one stdio call
+// per character; command lines and raw upload bytes are then taken out of
+// the ring. A burst that arrived in one poll is split and handed over in
+// that poll, so the last line of it waits no longer than the first.
+// Lines are handed out where they lie in the ring rather than copied into
+// a line buffer.
+//
+// Like FastLogger there is one instance, the USB port, so everything is
+// static. All calls come from the core running serial ingestion.
+class SerialInput {
+public:
+    static constexpr uint32_t BUFFER_SIZE = SWITCH_CONFIG.serial_buffer_size;
+    // Longest line, without its terminator; a line and the one being
+    // received behind it both have to fit the ring
+    static constexpr uint32_t MAX_LINE = BUFFER_SIZE / 2 - 1;
+
+    // Bulk read from the CDC FIFO of at most budget bytes, and no more than
+    // the ring has room for; the rest waits in the USB stack. Returns the
+    // bytes read.
+    static uint32_t receive(uint32_t budget = SWITCH_CONFIG.serial_budget);
+
+    // Next complete line, NUL-terminated in place of its terminator, or
+    // nullptr until one is buffered. The line stays valid until the next
+    // receive() or next_line(). received_us is when its first byte was read
+    // from USB. Empty lines are skipped; dropped counts the lines longer
+    // than MAX_LINE skipped on the way, which are also counted as overruns.
+    static const char* next_line(uint32_t& received_us, uint32_t& dropped);
+
+    // Raw bytes, for binary macro uploads
+    static bool read_byte(uint8_t& byte);
+
+    static uint32_t buffered() { return _write - _read; }
+
+    // Lines dropped for being too long, and the most bytes ever buffered
+    static uint32_t overruns() { return _overruns; }
+    static uint32_t high_water() { return _high_water; }
+
+private:
+    // The part of a line that wraps past the end of the ring is copied to
+    // the spare bytes after it, so every line is contiguous
+    static uint8_t _buffer[BUFFER_SIZE + MAX_LINE + 1];
+    static uint32_t _write;  // Free-running ring positions
+    static uint32_t _read;   // Start of the line being received
+    static uint32_t _scan;   // Bytes from _read up to here hold no line end
+    static bool _discarding; // Dropping the rest of an overlong line
+
+    // Ring position each recent bulk read started at, and when it happened
+    struct Stamp {
+        uint32_t pos;
+        uint32_t us;
+    };
+    static constexpr uint32_t STAMPS = 8;
+    static Stamp _stamps[STAMPS];
+    static uint32_t _stamp_head;  // Free-running; the entry before it is the newest
+    static uint32_t _stamp_tail;  // Oldest entry still covering unread bytes
+    static uint32_t read_time(uint32_t pos);
+
+    static uint32_t _overruns;
+    static uint32_t _high_water;
+};
+
+#endif
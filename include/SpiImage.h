@@ -0,0 +1,50 @@
+#ifndef SpiImage_h
+#define SpiImage_h
+
+#include <stdint.h>
+
+// Body and button colours reported at SPI 0x6050, as 0xRRGGBB
+#ifndef SWITCH_BODY_COLOR
+#define SWITCH_BODY_COLOR 0x323232
+#endif
+#ifndef SWITCH_BUTTON_COLOR
+#define SWITCH_BUTTON_COLOR 0xFFFFFF
+#endif
+
+// Sparse image of the controller's SPI flash as the console reads it during
+// pairing. The known ranges are a sorted constexpr table; a read at any
+// offset and length binary-searches it and copies the overlapping bytes,
+// everything else reads as erased flash (0xFF). A few runtime patches can
+// be layered on top, e.g. to change colours or calibration without a
+// rebuild.
+class SpiImage {
+public:
+    // Longest read that fits a subcommand reply
+    static constexpr uint8_t MAX_READ = 0x1D;
+    static constexpr int MAX_PATCHES = 8;
+    static constexpr int MAX_PATCH_LEN = 32;
+
+    struct Range {
+        uint32_t address;
+        uint8_t length;
+        const uint8_t *data;
+    };
+
+    void read(uint32_t address, uint8_t *out, uint8_t length) const;
+
+    // Runtime override, replacing an earlier patch at the same address
+    bool patch(uint32_t address, const uint8_t *data, uint8_t length);
+    void clear_patches() { _patch_count = 0; }
+
+private:
+    struct Patch {
+        uint32_t address;
+        uint8_t length;
+        uint8_t data[MAX_PATCH_LEN];
+    };
+
+    Patch _patches[MAX_PATCHES];
+    volatile uint8_t _patch_count = 0;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef StickMotion_h
+#define StickMotion_h
+
+#include <stdint.h>
+
+#include "InputOp.h"
+#include "InputQueue.h"
+#include "SwitchConsts.h"
+
+// Analog stick motions evaluated on the device once per HID frame, so a
+// sweep or a circle takes one command instead of a STICK line every frame:
+//   RAMP     straight line from the current position to a target over N frames
+//   CIRCLE   around the centre at a given radius, one turn every N frames
+//   OSC      sine wave on each axis around the centre, one cycle every N frames
+// Positions are worked out in fixed point from a sine table. A ramp stops on
+// its target; circles and oscillations run until the stick is set again,
+// another motion starts on it, or STOP.
+class StickMotion {
+public:
+    enum Kind : uint8_t { MOTION_RAMP, MOTION_CIRCLE, MOTION_CIRCLE_CW, MOTION_OSC };
+
+    // Takes a STICK_MOTION op: h/v are the ramp target, or the circle radius
+    // and oscillation amplitudes as raw offsets from the centre
+    void start(const InputOp& op);
+    void stop(uint8_t stick) { _active &= ~(1 << stick); }
+    void stop_all() { _active = 0; }
+    bool is_active() { return _active != 0; }
+
+    // Write this frame's position of every running motion into the queue;
+    // ramps start from the position the report holds when they first run
+    void run_frame(const SwitchReport& report, InputQueue& queue);
+
+    // Sine in Q15 of a phase where 2^32 is one turn
+    static int32_t sine(uint32_t phase);
+
+private:
+    struct Motion {
+        Kind kind;
+        uint16_t frames;
+        uint16_t h, v;
+        uint16_t start_h, start_v;
+        uint32_t step;        // Frames written so far
+        uint32_t phase;
+        uint32_t phase_step;
+    };
+    Motion _motions[2];
+    uint8_t _active = 0;  // Bit per stick
+};
+
+#endif
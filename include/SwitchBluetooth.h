@@ -1,50 +1,137 @@
 #ifndef SwitchBluetooth_h
 #define SwitchBluetooth_h
 
+#include "Histogram.h"
+#include "ImuStream.h"
+#include "InputOp.h"
+#include "InputQueue.h"
+#include "MacroVM.h"
+#include "RumbleDecoder.h"
+#include "SpiImage.h"
+#include "StickMotion.h"
+#include "SwitchConfig.h"
 #include "SwitchConsts.h"
+#include "Timeline.h"
 #include "btstack.h"
 
 class SwitchBluetooth {
  public:
+  // Bytes of each input report sent over the interrupt channel
+  static constexpr uint16_t HID_REPORT_SIZE = 50;
+
   void init();
-  void setHidCid(uint16_t hid_cid) { _hid_cid = hid_cid; };
+  void setHidCid(uint16_t hid_cid);
   uint16_t getHidCid() { return _hid_cid; };
   uint8_t *generate_report();
-  void setSwitchRequestReport(uint8_t *report, int report_size);
-  void set_empty_switch_request_report();
-  void set_controller_rumble(bool rumble);
-  
-  // Button control methods
-  void set_button(const char* button, bool pressed);
-  void set_stick(const char* stick, float h, float v);
-  
-  // Direct state modification (used internally by queue processor)
-  void set_button_direct(const char* button, bool pressed);
-  void set_stick_direct(const char* stick, float h, float v);
+  bool queue_subcommand(uint16_t report_id, const uint8_t *report, int report_size);
+  void decode_rumble(uint16_t report_id, const uint8_t *report, int report_size);
   
   // Bluetooth timing control
-  bool can_send_hid_report();
+  void mark_can_send();
   void mark_report_sent();
-  bool has_pending_update() { return _pending_report_update; }
-  bool has_config_request() { return _switchRequestReport[10] != 0x00; }
   bool is_paired() { return _device_info_queried; }
-  void wait_for_hid_transmission();
+
+  // Console link: the controller address and the last console it connected
+  // to persist in BTstack's TLV store next to the link keys, so after a
+  // reboot the controller pages that console instead of waiting to pair
+  void reconnect();
+  void remember_console(const bd_addr_t console);
+  uint32_t connect_ms() { return _connect_ms; }            // Link down (or boot) to connection
+  uint32_t first_report_ms() { return _first_report_ms; }  // Link down (or boot) to first 0x30
   
-  // Command queue and frame consolidation
+  // Command queue and frame consolidation. Producer side: writes go into
+  // the frame being built and are published to the send path as a snapshot.
   void start_consolidation();
   void end_consolidation();
-  void queue_button_command(const char* button, bool pressed);
-  void queue_stick_command(const char* stick, float h, float v);
+  bool queue_op(const InputOp &op);
   void process_command_queue();
   bool has_queued_commands();
 
+  // Frame-quantized timeline playback, on the producer side. Called often
+  // (every serial poll); each call moves due events into the frame being
+  // built and starts a new frame once the previous one has been sent.
+  Timeline &timeline() { return _timeline; }
+  void play_due_events();
+  uint32_t frame_count() { return _frame_counter; }
+
+  // Writes pending for the frame being built
+  InputQueue &input_queue() { return _input_queue; }
+
+  // Stored macro program, stepped alongside the timeline
+  MacroVM &vm() { return _vm; }
+
+  // Stick ramps, circles and oscillations, stepped after the macro program
+  StickMotion &stick_motion() { return _stick_motion; }
+
+  // Host-streamed motion samples for full input reports
+  ImuStream &imu_stream() { return _imu_stream; }
+
+  // SPI flash contents answered to the console's reads
+  SpiImage &spi_image() { return _spi_image; }
+
+  // Input latency per stage, recorded when SWITCH_CONFIG.trace is set:
+  // first byte of a line to the end of its parse, due event to entering
+  // the input queue, queue to the report carrying it, and the whole path
+  enum LatencyStage : uint8_t { LATENCY_PARSE, LATENCY_QUEUE, LATENCY_SEND, LATENCY_TOTAL, LATENCY_STAGES };
+  Histogram &latency(LatencyStage stage) { return _latency[stage]; }
+
+  // HID transmit cadence, recorded when SWITCH_CONFIG.trace is set. A frame
+  // is late when it carries changed input more than LATE_FRAME_US after
+  // the previous report.
+  static constexpr uint32_t LATE_FRAME_US = 16000;  // Two 125 Hz frames
+  struct HidStats {
+    Histogram can_send_interval;  // Between HID_SUBEVENT_CAN_SEND_NOW events
+    Histogram send_interval;      // Between reports sent
+    uint32_t input_reports;       // 0x30 full input
+    uint32_t reply_reports;       // 0x21 subcommand reply
+    uint32_t late_frames;
+    // Snapshot handoff from the producer, zero unless SWITCH_CONFIG.trace
+    uint32_t snapshot_retries;    // Copies redone because the producer published twice
+    uint32_t snapshots_replaced;  // Published but superseded before being taken
+  };
+  HidStats &hid_stats() { return _hid_stats; }
+  void reset_stats();
+
  private:
   uint16_t _hid_cid = 0;
   SwitchReport _switchReport = {
       .batteryConnection = 0x91, .buttons = {0x0}, .l = {0x0}, .r = {0x0}};
-  uint8_t _report[100] = {0x0};
-  uint8_t _switchRequestReport[100] = {0x0};
+  // Reports are built into the back buffer, patching only the bytes that
+  // change over the template already in it, then swapped to the front.
+  // _report points at the buffer being built.
+  enum ReportKind : uint8_t { REPORT_NONE, REPORT_INPUT, REPORT_INPUT_IMU, REPORT_REPLY };
+  uint8_t _report_buffers[2][100] = {{0x0}};
+  ReportKind _report_kind[2] = {REPORT_NONE, REPORT_NONE};
+  uint8_t _back_buffer = 0;
+  uint8_t *_report = _report_buffers[0];
+
+  // Subcommand requests waiting for a reply, answered one per report in
+  // arrival order. Only the subcommand ID and its leading argument bytes
+  // are kept.
+  static constexpr int SUBCOMMAND_ARGS = 8;
+  static constexpr uint8_t REQUEST_QUEUE_SIZE = SWITCH_CONFIG.request_queue_size;
+  struct SubcommandRequest {
+    uint8_t id;
+    uint8_t args[SUBCOMMAND_ARGS];
+  };
+  SubcommandRequest _requests[REQUEST_QUEUE_SIZE];
+  uint8_t _request_head = 0;
+  uint8_t _request_tail = 0;
+
+  // Reply handlers indexed by subcommand ID, built at compile time
+  typedef void (SwitchBluetooth::*SubcommandHandler)(const SubcommandRequest &request);
+  struct SubcommandTable {
+    SubcommandHandler handlers[256];
+  };
+  static constexpr SubcommandTable build_subcommand_table();
+  static const SubcommandTable SUBCOMMAND_TABLE;
   uint8_t _addr[6] = {0x0};
+  static constexpr uint32_t TLV_TAG_ADDRESS = 0x53574144;  // 'SWAD'
+  static constexpr uint32_t TLV_TAG_CONSOLE = 0x5357434E;  // 'SWCN'
+  bd_addr_t _console = {0x0};
+  bool _console_known = false;
+  void load_identity();
+  RumbleDecoder _rumble;
   bool _vibration_enabled = false;
   uint8_t _vibration_report = 0x00;
   uint8_t _vibration_idx = 0x00;
@@ -54,49 +141,91 @@ class SwitchBluetooth {
   uint32_t _timer = 0;
   uint32_t _timestamp = 0;
   
-  // Bluetooth timing control for 125Hz HID rate (8ms intervals)
-  uint32_t _last_hid_report_time = 0;
-  bool _pending_report_update = false;
+  // Report timing in microseconds, 0 until the first one of a connection
+  uint32_t _last_can_send_us = 0;
+  uint32_t _last_send_us = 0;
+  uint32_t _connected_us = 0;
+  uint32_t _link_down_us = 0;    // Boot, or the latest disconnect
+  uint32_t _connect_ms = 0;
+  uint32_t _first_report_ms = 0;
+  bool _first_report_pending = false;
   
-  // Command queue system for reliable frame consolidation
-  struct QueuedCommand {
-    enum Type { BUTTON_PRESS, BUTTON_RELEASE, STICK_SET } type;
-    char button_name[16];
-    bool pressed;
-    float stick_h, stick_v;
-  };
+  // D-pad directions currently held, as a SWITCH_HAT_* bitmap
+  uint8_t _dpad = 0;
   
-  static const int MAX_QUEUE_SIZE = 32;
-  QueuedCommand _command_queue[MAX_QUEUE_SIZE];
-  volatile int _queue_head = 0;
-  volatile int _queue_tail = 0;
-  volatile bool _queue_full = false;
+  // Coalescing queue of writes for the next frame
+  InputQueue _input_queue;
   
   // Frame consolidation system
   bool _consolidation_active = false;
-  uint32_t _consolidation_start_time = 0;
-  static const uint32_t CONSOLIDATION_WINDOW_MS = 3; // 3ms window for command consolidation
+
+  // Scheduled commands, released into the frame being built
+  Timeline _timeline;
+  uint32_t _frame_counter = 0;  // Frames built by the producer
+  MacroVM _vm;
+  StickMotion _stick_motion;
+  ImuStream _imu_stream;
+  SpiImage _spi_image;
+
+  // Complete input state handed from the producer to the HID send path.
+  // The producer fills the slot the reader is not on and then publishes
+  // it; the send path copies the latest one without waiting or touching
+  // the queues, and reports which one it took so the producer knows when
+  // the frame it is building has gone out.
+  struct InputSnapshot {
+    SwitchReport report;
+    uint32_t frame;
+    bool changed;     // Input changed since the previous frame
+    bool traced;      // Carries timeline events with latency stamps
+    uint32_t origin_us;
+    uint32_t queued_us;
+  };
+  InputSnapshot _snapshots[2] = {};
+  volatile uint32_t _publish_seq = 0;  // Snapshots published
+  volatile uint32_t _write_seq = 0;    // Snapshots started
+  volatile uint32_t _taken_seq = 0;    // Latest snapshot the send path copied
+  void publish_snapshot();
+  void take_snapshot();
+  bool frame_taken();
+  void commit_frame();
+
+  // Producer state of the frame being built
+  uint32_t _frame_first_seq = 0;  // First snapshot published for it
+  bool _frame_published = false;
+  bool _vm_stepped = false;
+  uint64_t _step_due_us = 0;
+  uint32_t _step_frame = 0;       // Frame the latest timeline event went into
+  bool _frame_traced = false;
+  uint32_t _frame_origin_us = 0;
+  uint32_t _frame_queued_us = 0;
+  void trace_queued(const Timeline::Event &event, uint32_t now_us);
+
+  // Send path copy of the snapshot in the report being built
+  InputSnapshot _taken = {};
+  uint32_t _sent_frame = UINT32_MAX;
+
+  Histogram _latency[LATENCY_STAGES];
+  HidStats _hid_stats = {};
   
   // Helper methods (from SwitchCommon)
-  void set_empty_report();
+  void begin_report(ReportKind kind);
   void set_subcommand_reply();
-  void set_unknown_subcommand(uint8_t subcommand_id);
+  void set_unknown_subcommand(const SubcommandRequest &request);
   void set_timer();
   void set_full_input_report();
   void set_standard_input_report();
-  void set_bt();
-  void set_device_info();
-  void set_shipment();
-  void toggle_imu();
-  void imu_sensitivity();
-  void set_imu_data();
-  void spi_read();
-  void set_mode();
-  void set_trigger_buttons();
-  void enable_vibration();
-  void set_player_lights();
-  void set_nfc_ir_state();
-  void set_nfc_ir_config();
+  void set_bt(const SubcommandRequest &request);
+  void set_device_info(const SubcommandRequest &request);
+  void set_shipment(const SubcommandRequest &request);
+  void toggle_imu(const SubcommandRequest &request);
+  void imu_sensitivity(const SubcommandRequest &request);
+  void spi_read(const SubcommandRequest &request);
+  void set_mode(const SubcommandRequest &request);
+  void set_trigger_buttons(const SubcommandRequest &request);
+  void enable_vibration(const SubcommandRequest &request);
+  void set_player_lights(const SubcommandRequest &request);
+  void set_nfc_ir_state(const SubcommandRequest &request);
+  void set_nfc_ir_config(const SubcommandRequest &request);
 };
 
 void packet_handler(SwitchBluetooth *inst, uint8_t packet_type, uint8_t *packet);
@@ -0,0 +1,90 @@
+#ifndef SwitchConfig_h
+#define SwitchConfig_h
+
+#include <stdint.h>
+
+// Build presets, selected with -DSWITCH_PRESET=<name> in CMake
+#define SWITCH_PRESET_DEFAULT 0
+#define SWITCH_PRESET_MINIMAL 1     // Lowest latency: no diagnostics in the HID path
+#define SWITCH_PRESET_DIAGNOSTIC 2  // Everything logged and traced, deeper buffers
+#ifndef SWITCH_PRESET
+#define SWITCH_PRESET SWITCH_PRESET_DEFAULT
+#endif
+
+// Logged messages carry a subsystem and a level (see LogMessages.h), and so
+// do free-form text logs. A message is compiled in only if its level is at
+// or below the subsystem's threshold; LOG_REPLY messages answer host
+// commands and are always kept.
+enum LogLevel : uint8_t { LOG_REPLY, LOG_ERROR, LOG_INFO, LOG_DEBUG };
+enum LogSubsystem : uint8_t { LOG_HID, LOG_PARSER, LOG_MACRO, LOG_STORE, LOG_SUBSYSTEMS };
+
+// Compile-time policy for the controller, its queues and the logger
+struct SwitchConfig {
+    uint32_t timeline_capacity;   // Scheduled input events, power of two
+    uint8_t request_queue_size;   // Pending subcommand requests, power of two
+    uint32_t log_buffer_size;     // Log ring bytes, power of two
+    uint32_t serial_buffer_size;  // USB receive ring bytes, power of two
+    uint32_t serial_budget;       // Most bytes read from USB per poll
+    LogLevel log_level[LOG_SUBSYSTEMS];
+    bool imu;    // Send IMU samples once the console enables them
+    uint32_t imu_frames;          // Host-streamed IMU frames buffered, power of two
+    bool rumble;  // Decode rumble and report changes to the host
+    bool trace;  // Queue depth, wait and coalescing counters
+};
+
+constexpr SwitchConfig MINIMAL_CONFIG = {
+    .timeline_capacity = 256,
+    .request_queue_size = 8,
+    .log_buffer_size = 1024,
+    .serial_buffer_size = 2048,
+    .serial_budget = 1024,
+    .log_level = {LOG_REPLY, LOG_ERROR, LOG_ERROR, LOG_ERROR},
+    .imu = false,
+    .imu_frames = 1,
+    .rumble = false,
+    .trace = false,
+};
+
+constexpr SwitchConfig DEFAULT_CONFIG = {
+    .timeline_capacity = 256,
+    .request_queue_size = 8,
+    .log_buffer_size = 2048,
+    .serial_buffer_size = 4096,
+    .serial_budget = 2048,
+    .log_level = {LOG_INFO, LOG_INFO, LOG_INFO, LOG_INFO},
+    .imu = true,
+    .imu_frames = 32,
+    .rumble = true,
+    .trace = true,
+};
+
+constexpr SwitchConfig DIAGNOSTIC_CONFIG = {
+    .timeline_capacity = 512,
+    .request_queue_size = 16,
+    .log_buffer_size = 8192,
+    .serial_buffer_size = 4096,
+    .serial_budget = 2048,
+    .log_level = {LOG_DEBUG, LOG_DEBUG, LOG_DEBUG, LOG_DEBUG},
+    .imu = true,
+    .imu_frames = 64,
+    .rumble = true,
+    .trace = true,
+};
+
+#if SWITCH_PRESET == SWITCH_PRESET_MINIMAL
+constexpr SwitchConfig SWITCH_CONFIG = MINIMAL_CONFIG;
+#elif SWITCH_PRESET == SWITCH_PRESET_DIAGNOSTIC
+constexpr SwitchConfig SWITCH_CONFIG = DIAGNOSTIC_CONFIG;
+#else
+constexpr SwitchConfig SWITCH_CONFIG = DEFAULT_CONFIG;
+#endif
+
+constexpr bool is_power_of_two(uint32_t value) { return value != 0 && (value & (value - 1)) == 0; }
+static_assert(is_power_of_two(SWITCH_CONFIG.timeline_capacity), "Timeline capacity must be a power of two");
+static_assert(is_power_of_two(SWITCH_CONFIG.request_queue_size) && SWITCH_CONFIG.request_queue_size <= 128,
+              "Request queue size must be a power of two up to 128");
+static_assert(is_power_of_two(SWITCH_CONFIG.log_buffer_size), "Log buffer size must be a power of two");
+static_assert(is_power_of_two(SWITCH_CONFIG.serial_buffer_size), "Serial buffer size must be a power of two");
+static_assert(is_power_of_two(SWITCH_CONFIG.imu_frames), "IMU frame buffer must be a power of two");
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef Timeline_h
+#define Timeline_h
+
+#include <stdint.h>
+
+#include "InputOp.h"
+#include "SwitchConfig.h"
+
+// Schedule of parsed input commands waiting to be played out.
+// Every event is stamped with the time it becomes due. SLEEP only moves the
+// schedule cursor forward, so serial ingestion keeps filling the queue while
+// earlier events play out. Events are released into the frame being built
+// by SwitchBluetooth::play_due_events().
+//
+// The ring is single-producer/single-consumer and lock-free, so the parser
+// and playback need not run on the same core.
+class Timeline {
+public:
+    struct Event {
+        InputOp op;
+        uint64_t due_us;
+        // Frames that must be built after the previous event's before this
+        // one is released, so held input reaches the console for that many
+        // reports regardless of report cadence
+        uint8_t after_frames;
+        // Latency tracing (SWITCH_CONFIG.trace): when the event was both
+        // parsed and due, and when its line arrived shifted by any SLEEP
+        // before it, so intended delays are not counted as latency
+        uint32_t ready_us;
+        uint32_t origin_us;
+    };
+
+    static constexpr uint32_t CAPACITY = SWITCH_CONFIG.timeline_capacity;
+
+    void reset();
+
+    // Producer side (command parser)
+    void begin_line(uint32_t received_us) { _received_us = received_us; }
+    bool schedule(const InputOp& op, uint8_t after_frames = 0);
+    void delay(uint32_t duration_us);
+    void cancel();
+    uint32_t free_slots() { return CAPACITY - (_tail - _head); }
+
+    // Consumer side (HID frame)
+    const Event* peek_due(uint64_t now_us);
+    void pop();
+    bool is_empty() { return _head == _tail; }
+
+private:
+    Event _events[CAPACITY];
+    volatile uint32_t _head = 0;  // Free-running count of events popped
+    volatile uint32_t _tail = 0;  // Free-running count of events pushed
+    uint64_t _cursor_us = 0;      // Due time for the next scheduled event
+    uint32_t _received_us = 0;    // Arrival of the line being parsed
+    volatile uint32_t _cancel_requests = 0;
+    volatile uint32_t _cancel_tail = 0;     // Tail when the latest cancel was requested
+    uint32_t _cancel_handled = 0;           // Consumer side
+};
+
+#endif
@@ -0,0 +1,19 @@
+#include "BootProfile.h"
+#include "pico/stdlib.h"
+
+uint32_t BootProfile::_times[BootProfile::PHASES] = {};
+
+static const char* const PHASE_NAMES[BootProfile::PHASES] = {
+    "main", "radio", "stack", "power_on", "usb", "store",
+    "discoverable", "connected", "device_info", "first_report"};
+
+void BootProfile::mark(Phase phase) {
+    if (_times[phase] == 0) {
+        uint32_t now = time_us_32();
+        _times[phase] = now ? now : 1;
+    }
+}
+
+const char* BootProfile::name(Phase phase) {
+    return PHASE_NAMES[phase];
+}
@@ -1,223 +1,681 @@
 #include "CommandParser.h"
 #include <cstring>
-#include <cstdlib>
 #include <cctype>
 #include <cstdio>
 #include "pico/stdlib.h"
+#include "BootProfile.h"
 #include "FastLogger.h"
+#include "SerialInput.h"
 
-CommandParser::CommandParser(SwitchBluetooth* switch_controller) : _switch(switch_controller) {}
+// The longest IMU line has to fit a serial line
+static_assert(4 + CommandParser::MAX_IMU_SAMPLES_PER_LINE * ImuStream::SAMPLE_SIZE * 2 <= SerialInput::MAX_LINE,
+              "IMU samples per line exceed the serial line length");
 
-bool CommandParser::parse_and_execute(const char* command_line) {
+CommandParser::CommandParser(SwitchBluetooth* switch_controller, MacroStore* macro_store)
+    : _switch(switch_controller), _store(macro_store) {}
+
+CommandParser::Error CommandParser::parse_and_execute(const char* command_line, uint32_t received_us) {
+    _lines++;
+    _switch->timeline().begin_line(received_us);
+    Error error = execute(command_line);
+    if constexpr (SWITCH_CONFIG.trace) {
+        _switch->latency(SwitchBluetooth::LATENCY_PARSE).record(time_us_32() - received_us);
+    }
+    if (error != ERROR_NONE) {
+        FastLogger::log_event<LOG_COMMAND_ERROR>(error, _lines);
+    }
+    return error;
+}
+
+void CommandParser::reject_line(Error error) {
+    _lines++;
+    FastLogger::log_event<LOG_COMMAND_ERROR>(error, _lines);
+}
+
+CommandParser::Error CommandParser::execute(const char* command_line) {
     // Skip leading whitespace
     const char* ptr = command_line;
     skip_whitespace(ptr);
     
     if (*ptr == '\0' || *ptr == '#') {
-        return true; // Empty line or comment
-    }
-    
-    // Fast command identification by first character to avoid string comparisons
-    char first_char = toupper(*ptr);
-    
-    // Extract command
-    char command[16]; // Reduced buffer size
-    int i = 0;
-    while (*ptr && !isspace(*ptr) && i < sizeof(command) - 1) {
-        command[i++] = toupper(*ptr++);
+        return ERROR_NONE; // Empty line or comment
     }
-    command[i] = '\0';
     
-    // Skip whitespace between command and args
-    skip_whitespace(ptr);
+    // The command word is matched where it lies in the line, and each
+    // command reads its arguments from ptr in a single pass
+    Token command;
+    next_token(ptr, command);
     
-    // Execute command using optimized switch
-    switch (first_char) {
+    // Fast command identification by first character
+    switch (toupper(command.start[0])) {
         case 'P':
-            if (command[1] == 'R') { // "PRESS"
+            if (command.is("PRESS")) {
                 return parse_press_command(ptr);
             }
             break;
         case 'H':
-            if (command[1] == 'O') { // "HOLD" 
+            if (command.is("HOLD")) {
                 return parse_button_command(ptr, true);
             }
             break;
         case 'R':
-            if (command[1] == 'E') { // "RELEASE"
+            if (command.is("RELEASE")) {
                 return parse_button_command(ptr, false);
+            } else if (command.is("RUN")) {
+                return parse_run_command(ptr);
             }
             break;
         case 'S':
-            if (command[1] == 'T') { // "STICK"
+            if (command.is("STICK")) {
                 return parse_stick_command(ptr);
-            } else if (command[1] == 'L') { // "SLEEP"
+            } else if (command.is("SLEEP")) {
                 return parse_sleep_command(ptr);
+            } else if (command.is("STICK_RAMP")) {
+                return parse_stick_motion_command(StickMotion::MOTION_RAMP, ptr);
+            } else if (command.is("STICK_CIRCLE")) {
+                return parse_stick_motion_command(StickMotion::MOTION_CIRCLE, ptr);
+            } else if (command.is("STICK_OSC")) {
+                return parse_stick_motion_command(StickMotion::MOTION_OSC, ptr);
+            } else if (command.is("STOP")) {
+                return stop_command();
+            } else if (command.is("STATS")) {
+                return stats_command(ptr);
+            } else if (command.is("SPIWRITE")) {
+                return parse_spi_write_command(ptr);
+            }
+            break;
+        case 'B':
+            if (command.is("BOOTSTATS")) {
+                return bootstats_command();
+            }
+            break;
+        case 'I':
+            if (command.is("IMU")) {
+                return parse_imu_command(ptr);
+            }
+            break;
+        case 'U':
+            if (command.is("UPLOAD")) {
+                return parse_upload_command(ptr);
+            }
+            break;
+        case 'L':
+            if (command.is("LIST")) {
+                _store->list();
+                return ERROR_NONE;
+            }
+            break;
+        case 'E':
+            if (command.is("ERASE")) {
+                Token what;
+                if (!next_token(ptr, what) || !what.is("ALL") || *ptr) {
+                    FastLogger::log<LOG_PARSER, LOG_INFO>("Usage: ERASE ALL");
+                    return ERROR_BAD_ARGUMENT;
+                }
+                stop_command();
+                _store->erase_all();
+                return ERROR_NONE;
             }
             break;
-        default:
-            FastLogger::log_fmt("Unknown command: %s", command);
-            return false;
     }
     
-    FastLogger::log_fmt("Unknown command: %s", command);
-    return false;
+    FastLogger::log_fmt<LOG_PARSER, LOG_ERROR>("Unknown command: %.*s", (int)command.length, command.start);
+    return ERROR_UNKNOWN_COMMAND;
 }
 
-bool CommandParser::parse_button_command(const char* args, bool pressed) {
+// Button names up to the end of the line or a frame count ("PRESS a 3f"),
+// merged into one mask per report byte
+CommandParser::Error CommandParser::parse_buttons(const char*& ptr, uint8_t* masks) {
+    Token name;
+    while (!isdigit(*ptr) && next_token(ptr, name)) {
+        ButtonMask button;
+        if (!ButtonTable::lookup(name.start, name.length, button)) {
+            FastLogger::log_fmt<LOG_PARSER, LOG_ERROR>("Unknown button: %.*s", (int)name.length, name.start);
+            return ERROR_UNKNOWN_BUTTON;
+        }
+        masks[button.index] |= button.mask;
+    }
+    return ERROR_NONE;
+}
+
+CommandParser::Error CommandParser::schedule_buttons(const uint8_t* masks, bool pressed, uint8_t after_frames) {
+    // Events scheduled together are released into the same HID frame; only
+    // the first one waits, the rest follow it
+    for (uint8_t i = 0; i <= BUTTON_INDEX_DPAD; i++) {
+        if (!masks[i]) {
+            continue;
+        }
+        if (!_switch->timeline().schedule(InputOp::button({i, masks[i]}, pressed), after_frames)) {
+            FastLogger::log_event<LOG_TIMELINE_FULL_BUTTON>();
+            return ERROR_TIMELINE_FULL;
+        }
+        after_frames = 0;
+    }
+    return ERROR_NONE;
+}
+
+CommandParser::Error CommandParser::parse_button_command(const char* args, bool pressed) {
+    const char* ptr = args;
+    uint8_t masks[BUTTON_INDEX_DPAD + 1] = {0};
+    Error error = parse_buttons(ptr, masks);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+    if (*ptr || ptr == args) {
+        FastLogger::log<LOG_PARSER, LOG_INFO>(pressed ? "Usage: HOLD <buttons>" : "Usage: RELEASE <buttons>");
+        return ERROR_BAD_ARGUMENT;
+    }
+    return schedule_buttons(masks, pressed, 0);
+}
+
+CommandParser::Error CommandParser::parse_press_command(const char* args) {
+    // The button list is read once and scheduled twice, down and then up
+    const char* ptr = args;
+    uint8_t masks[BUTTON_INDEX_DPAD + 1] = {0};
+    Error error = parse_buttons(ptr, masks);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+    uint32_t frames;
+    if (ptr == args || !parse_press_frames(ptr, frames)) {
+        FastLogger::log<LOG_PARSER, LOG_INFO>("Usage: PRESS <buttons> [<1-255>f]");
+        return ERROR_BAD_ARGUMENT;
+    }
+
+    // The release is held back on the frame counter until the press has
+    // gone out in that many reports; it takes no time on the schedule
+    error = schedule_buttons(masks, true, 0);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+    return schedule_buttons(masks, false, frames);
+}
+
+CommandParser::Error CommandParser::parse_stick_command(const char* args) {
     const char* ptr = args;
-    char button_name[16]; // Reduced buffer size
     
-    // Start consolidation to group all buttons in one HID report
-    _switch->start_consolidation();
+    // Parse stick name
+    Token name;
+    uint8_t stick;
+    if (!next_token(ptr, name) || !ButtonTable::lookup_stick(name.start, name.length, stick)) {
+        FastLogger::log<LOG_PARSER, LOG_ERROR>("Invalid stick name for STICK command");
+        return ERROR_UNKNOWN_BUTTON;
+    }
     
-    // Parse multiple button names separated by spaces
-    while (*ptr) {
-        if (!parse_button_name(ptr, button_name, sizeof(button_name))) {
-            break; // No more buttons to parse
-        }
-        
-        _switch->set_button(button_name, pressed);
-        
-        // Skip to next button
-        skip_whitespace(ptr);
+    // Parse horizontal value
+    int32_t h, v;
+    if (!parse_fixed(ptr, h, InputOp::STICK_DECIMALS)) {
+        FastLogger::log<LOG_PARSER, LOG_ERROR>("Invalid horizontal value for STICK command");
+        return ERROR_BAD_ARGUMENT;
     }
     
-    // End consolidation and transmit as single frame
-    _switch->end_consolidation();
+    // Parse vertical value
+    if (!parse_fixed(ptr, v, InputOp::STICK_DECIMALS) || !at_end(ptr)) {
+        FastLogger::log<LOG_PARSER, LOG_ERROR>("Invalid vertical value for STICK command");
+        return ERROR_BAD_ARGUMENT;
+    }
     
-    return true;
+    if (!_switch->timeline().schedule(InputOp::stick(stick, h, v))) {
+        FastLogger::log_event<LOG_TIMELINE_FULL_STICK>();
+        return ERROR_TIMELINE_FULL;
+    }
+    
+    return ERROR_NONE;
+}
+
+// STICK_RAMP <stick> <h> <v> <frames>
+// STICK_CIRCLE <stick> <radius> <frames> [CW]
+// STICK_OSC <stick> <h amplitude> <v amplitude> <frames>
+CommandParser::Error CommandParser::parse_stick_motion_command(uint8_t motion, const char* args) {
+    const char* ptr = args;
+    Token name;
+    uint8_t stick;
+    if (!next_token(ptr, name) || !ButtonTable::lookup_stick(name.start, name.length, stick)) {
+        FastLogger::log<LOG_PARSER, LOG_ERROR>("Invalid stick name for stick motion");
+        return ERROR_UNKNOWN_BUTTON;
+    }
+
+    InputOp op;
+    int32_t h, v = 0;
+    uint32_t frames;
+    if (motion == StickMotion::MOTION_RAMP) {
+        if (!parse_fixed(ptr, h, InputOp::STICK_DECIMALS) ||
+            !parse_fixed(ptr, v, InputOp::STICK_DECIMALS) || !parse_uint(ptr, frames) || !at_end(ptr)) {
+            FastLogger::log<LOG_PARSER, LOG_INFO>("Usage: STICK_RAMP <stick> <h> <v> <frames>");
+            return ERROR_BAD_ARGUMENT;
+        }
+        op = InputOp::stick_motion(stick, motion, InputOp::stick_axis_to_raw(h), InputOp::stick_axis_to_raw(v), 0);
+    } else if (motion == StickMotion::MOTION_CIRCLE) {
+        Token direction;
+        if (!parse_fixed(ptr, h, InputOp::STICK_DECIMALS) || !parse_uint(ptr, frames) ||
+            (next_token(ptr, direction) && !direction.is("CW")) || *ptr) {
+            FastLogger::log<LOG_PARSER, LOG_INFO>("Usage: STICK_CIRCLE <stick> <radius> <frames> [CW]");
+            return ERROR_BAD_ARGUMENT;
+        }
+        if (direction.length > 0) {
+            motion = StickMotion::MOTION_CIRCLE_CW;
+        }
+        op = InputOp::stick_motion(stick, motion, InputOp::stick_offset_to_raw(h), 0, 0);
+    } else {
+        if (!parse_fixed(ptr, h, InputOp::STICK_DECIMALS) ||
+            !parse_fixed(ptr, v, InputOp::STICK_DECIMALS) || !parse_uint(ptr, frames) || !at_end(ptr)) {
+            FastLogger::log<LOG_PARSER, LOG_INFO>("Usage: STICK_OSC <stick> <h amplitude> <v amplitude> <frames>");
+            return ERROR_BAD_ARGUMENT;
+        }
+        op = InputOp::stick_motion(stick, motion, InputOp::stick_offset_to_raw(h), InputOp::stick_offset_to_raw(v), 0);
+    }
+
+    if (frames == 0 || frames > MAX_MOTION_FRAMES) {
+        FastLogger::log<LOG_PARSER, LOG_ERROR>("Stick motion frames must be 1-65535");
+        return ERROR_BAD_ARGUMENT;
+    }
+    op.frames = (uint16_t)frames;
+
+    if (!_switch->timeline().schedule(op)) {
+        FastLogger::log_event<LOG_TIMELINE_FULL_STICK>();
+        return ERROR_TIMELINE_FULL;
+    }
+    return ERROR_NONE;
 }
 
-bool CommandParser::parse_press_command(const char* args) {
-    // PRESS command using consolidation for maximum reliability
+CommandParser::Error CommandParser::parse_sleep_command(const char* args) {
     const char* ptr = args;
-    char button_name[16];
     
-    // Start consolidation for press phase
-    _switch->start_consolidation();
+    uint64_t duration_us;
+    if (!parse_seconds_us(ptr, duration_us) || !at_end(ptr)) {
+        FastLogger::log<LOG_PARSER, LOG_INFO>("Usage: SLEEP <seconds>");
+        return ERROR_BAD_ARGUMENT;
+    }
+    if (duration_us > UINT32_MAX) {
+        FastLogger::log<LOG_PARSER, LOG_ERROR>("SLEEP too long");
+        return ERROR_BAD_ARGUMENT;
+    }
+    
+    // Move the schedule cursor; ingestion carries on while the timeline plays
+    _switch->timeline().delay((uint32_t)duration_us);
     
-    // Press all buttons in same frame
-    while (*ptr) {
-        if (!parse_button_name(ptr, button_name, sizeof(button_name))) {
-            break;
-        }
-        
-        _switch->set_button(button_name, true);
-        skip_whitespace(ptr);
+    return ERROR_NONE;
+}
+
+CommandParser::Error CommandParser::parse_upload_command(const char* args) {
+    const char* ptr = args;
+    uint32_t slot, length;
+    if (!parse_uint(ptr, slot) || !parse_uint(ptr, length) || !at_end(ptr) ||
+        slot >= MacroStore::MAX_SLOTS) {
+        FastLogger::log<LOG_PARSER, LOG_INFO>("Usage: UPLOAD <slot 0-15> <length>");
+        return ERROR_BAD_ARGUMENT;
     }
     
-    // End press consolidation and transmit
-    _switch->end_consolidation();
+    // The store takes the raw chunks that follow straight from the serial link
+    return _store->begin_upload(slot, length) ? ERROR_NONE : ERROR_REJECTED;
+}
+
+CommandParser::Error CommandParser::parse_run_command(const char* args) {
+    const char* ptr = args;
+    uint32_t slot;
+    uint32_t repeats = 1;
+    if (!parse_uint(ptr, slot) || (!at_end(ptr) && (!parse_uint(ptr, repeats) || !at_end(ptr))) ||
+        slot >= MacroStore::MAX_SLOTS) {
+        FastLogger::log<LOG_PARSER, LOG_INFO>("Usage: RUN <slot 0-15> [count]");
+        return ERROR_BAD_ARGUMENT;
+    }
     
-    // Start consolidation for release phase  
-    _switch->start_consolidation();
+    const uint8_t* data;
+    uint32_t length;
+    if (!_store->find(slot, data, length)) {
+        FastLogger::log_event<LOG_NO_MACRO>(slot);
+        return ERROR_REJECTED;
+    }
     
-    // Release all buttons in same frame
-    ptr = args;  // Reset pointer
-    while (*ptr) {
-        if (!parse_button_name(ptr, button_name, sizeof(button_name))) {
-            break;
+    // Uploads that already hold bytecode skip the assembler
+    const uint32_t* program = reinterpret_cast<const uint32_t*>(data);
+    uint32_t words = length / 4;
+    if (length < 4 || program[0] != MacroVM::MAGIC) {
+        _switch->vm().stop();
+        words = _assembler.assemble(reinterpret_cast<const char*>(data), length, _program, PROGRAM_WORDS);
+        if (words == 0) {
+            return ERROR_REJECTED;
         }
-        
-        _switch->set_button(button_name, false);
-        skip_whitespace(ptr);
+        program = _program;
     }
     
-    // End release consolidation and transmit
-    _switch->end_consolidation();
-    
-    return true;
+    if (!_switch->vm().start(program, words, repeats)) {
+        return ERROR_REJECTED;
+    }
+    FastLogger::log_event<LOG_RUNNING_MACRO>(slot, words - 1);
+    return ERROR_NONE;
 }
 
-bool CommandParser::parse_stick_command(const char* args) {
+CommandParser::Error CommandParser::parse_spi_write_command(const char* args) {
     const char* ptr = args;
-    skip_whitespace(ptr);
     
-    // Parse stick name
-    char stick_name[32];
-    if (!parse_button_name(ptr, stick_name, sizeof(stick_name))) {
-        FastLogger::log("Invalid stick name for STICK command");
-        return false;
+    uint32_t address;
+    if (!parse_hex_uint(ptr, address) || !isspace(*ptr)) {
+        FastLogger::log<LOG_PARSER, LOG_INFO>("Usage: SPIWRITE <hex address> <hex bytes>");
+        return ERROR_BAD_ARGUMENT;
     }
     
-    // Parse horizontal value
-    float h, v;
-    if (!parse_float(ptr, h)) {
-        FastLogger::log("Invalid horizontal value for STICK command");
-        return false;
+    uint8_t data[SpiImage::MAX_PATCH_LEN];
+    size_t length;
+    if (!parse_hex_bytes(ptr, data, sizeof(data), length)) {
+        FastLogger::log<LOG_PARSER, LOG_INFO>("Usage: SPIWRITE <hex address> <hex bytes>");
+        return ERROR_BAD_ARGUMENT;
     }
     
-    // Parse vertical value
-    if (!parse_float(ptr, v)) {
-        FastLogger::log("Invalid vertical value for STICK command");
-        return false;
+    if (!_switch->spi_image().patch(address, data, length)) {
+        FastLogger::log<LOG_PARSER, LOG_ERROR>("SPI patch table full");
+        return ERROR_REJECTED;
+    }
+    return ERROR_NONE;
+}
+
+// IMU <hex samples>: each 12-byte sample is accel x, y, z then gyro x, y, z
+// as little-endian int16, the layout the report carries
+CommandParser::Error CommandParser::parse_imu_command(const char* args) {
+    if constexpr (!SWITCH_CONFIG.imu) {
+        FastLogger::log<LOG_PARSER, LOG_ERROR>("IMU not supported in this build");
+        return ERROR_REJECTED;
     }
     
-    // Use consolidation for stick commands too
-    _switch->start_consolidation();
-    _switch->set_stick(stick_name, h, v);
-    _switch->end_consolidation();
+    const char* ptr = args;
+    uint8_t data[MAX_IMU_SAMPLES_PER_LINE * ImuStream::SAMPLE_SIZE];
+    size_t length;
+    if (!parse_hex_bytes(ptr, data, sizeof(data), length) || length % ImuStream::SAMPLE_SIZE != 0) {
+        FastLogger::log<LOG_PARSER, LOG_INFO>("Usage: IMU <12 hex bytes per sample>");
+        return ERROR_BAD_ARGUMENT;
+    }
     
-    return true;
+    if (!_switch->imu_stream().push(data, length / ImuStream::SAMPLE_SIZE)) {
+        FastLogger::log<LOG_PARSER, LOG_ERROR>("IMU buffer full");
+        return ERROR_REJECTED;
+    }
+    return ERROR_NONE;
 }
 
-bool CommandParser::parse_sleep_command(const char* args) {
-    const char* ptr = args;
+CommandParser::Error CommandParser::stop_command() {
+    _switch->vm().stop();
+    
+    // Drop whatever is still scheduled and leave the controller neutral
+    Timeline& timeline = _switch->timeline();
+    timeline.cancel();
+    timeline.schedule(InputOp::button({0, 0xFF}, false));
+    timeline.schedule(InputOp::button({1, 0xFF}, false));
+    timeline.schedule(InputOp::button({2, 0xF0}, false));
+    timeline.schedule(InputOp::button({BUTTON_INDEX_DPAD, 0x0F}, false));
+    timeline.schedule(InputOp::stick(STICK_LEFT, 0, 0));
+    timeline.schedule(InputOp::stick(STICK_RIGHT, 0, 0));
+    return ERROR_NONE;
+}
+
+void CommandParser::skip_whitespace(const char*& ptr) {
+    while (*ptr && isspace(*ptr)) {
+        ptr++;
+    }
+}
+
+bool CommandParser::at_end(const char*& ptr) {
+    skip_whitespace(ptr);
+    return *ptr == '\0';
+}
+
+bool CommandParser::next_token(const char*& ptr, Token& token) {
+    skip_whitespace(ptr);
+    token.start = ptr;
+    while (*ptr && !isspace(*ptr)) {
+        ptr++;
+    }
+    token.length = ptr - token.start;
     skip_whitespace(ptr);
+    return token.length > 0;
+}
+
+bool CommandParser::Token::is(const char* word) const {
+    for (size_t i = 0; i < length; i++) {
+        if (word[i] != ButtonTable::to_upper(start[i])) {
+            return false; // Also stops at the end of a shorter word
+        }
+    }
+    return word[length] == '\0';
+}
+
+// A decimal number split into its whole part and its fraction scaled to a
+// fixed number of digits. Parsed by hand: strtof would pull soft-float into
+// a core without an FPU.
+struct Decimal {
+    bool negative;
+    uint32_t whole;
+    uint32_t frac;
+};
+
+static constexpr uint8_t MAX_DECIMALS = 6;
+static const uint32_t POWERS_OF_TEN[MAX_DECIMALS + 1] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+static bool parse_decimal(const char*& ptr, uint8_t decimals, Decimal& out) {
+    CommandParser::skip_whitespace(ptr);
+    const char* p = ptr;
     
-    float duration;
-    if (!parse_float(ptr, duration)) {
-        // Use fast logger instead of blocking printf
-        return false;
+    out.negative = *p == '-';
+    if (*p == '-' || *p == '+') {
+        p++;
     }
     
-    // Convert to milliseconds and set up non-blocking sleep
-    uint32_t sleep_duration_ms = (uint32_t)(duration * 1000);
-    _sleep_active = true;
-    _sleep_end_time = to_ms_since_boot(get_absolute_time()) + sleep_duration_ms;
+    bool digits = false;
+    uint32_t whole = 0;
+    while (isdigit(*p)) {
+        uint32_t digit = *p++ - '0';
+        if (whole > (UINT32_MAX - digit) / 10) {
+            return false; // Overflow
+        }
+        whole = whole * 10 + digit;
+        digits = true;
+    }
+    
+    uint32_t frac = 0;
+    uint8_t places = 0;
+    if (*p == '.') {
+        p++;
+        while (isdigit(*p)) {
+            if (places < decimals) {
+                frac = frac * 10 + (*p - '0');
+                places++;
+            }
+            p++;
+            digits = true;
+        }
+    }
     
+    if (!digits) {
+        return false; // No digits found
+    }
+    
+    out.whole = whole;
+    out.frac = frac * POWERS_OF_TEN[decimals - places];
+    ptr = p;
     return true;
 }
 
-bool CommandParser::is_sleeping() {
-    return _sleep_active;
+bool CommandParser::parse_fixed(const char*& ptr, int32_t& value, uint8_t decimals) {
+    Decimal decimal;
+    if (decimals > MAX_DECIMALS || !parse_decimal(ptr, decimals, decimal)) {
+        return false;
+    }
+    
+    uint32_t scale = POWERS_OF_TEN[decimals];
+    if (decimal.whole > (INT32_MAX - decimal.frac) / scale) {
+        return false; // Overflow
+    }
+    value = (int32_t)(decimal.whole * scale + decimal.frac);
+    if (decimal.negative) {
+        value = -value;
+    }
+    return true;
 }
 
-void CommandParser::update_sleep_state() {
-    if (_sleep_active && to_ms_since_boot(get_absolute_time()) >= _sleep_end_time) {
-        _sleep_active = false;
+// Seconds to exact integer microseconds
+bool CommandParser::parse_seconds_us(const char*& ptr, uint64_t& us) {
+    Decimal decimal;
+    if (!parse_decimal(ptr, MAX_DECIMALS, decimal) || decimal.negative) {
+        return false;
     }
+    us = (uint64_t)decimal.whole * 1000000 + decimal.frac;
+    return true;
 }
 
-void CommandParser::skip_whitespace(const char*& ptr) {
-    while (*ptr && isspace(*ptr)) {
-        ptr++;
+// A run of hex digits, optionally split by spaces, up to the end of the line
+bool CommandParser::parse_hex_bytes(const char*& ptr, uint8_t* data, size_t capacity, size_t& length) {
+    length = 0;
+    int nibbles = 0;
+    for (; *ptr; ptr++) {
+        if (isspace(*ptr)) {
+            continue;
+        }
+        if (!isxdigit(*ptr) || (!(nibbles & 1) && length == capacity)) {
+            return false;
+        }
+        uint8_t nibble = isdigit(*ptr) ? *ptr - '0' : tolower(*ptr) - 'a' + 10;
+        if (nibbles & 1) {
+            data[length++] |= nibble;
+        } else {
+            data[length] = nibble << 4;
+        }
+        nibbles++;
     }
+    return nibbles > 0 && !(nibbles & 1);
 }
 
-bool CommandParser::parse_float(const char*& ptr, float& value) {
+// Digits only: strtoul would take a sign and wrap "-1" around
+bool CommandParser::parse_uint(const char*& ptr, uint32_t& value) {
     skip_whitespace(ptr);
     
-    char* end_ptr;
-    value = strtof(ptr, &end_ptr);
+    const char* p = ptr;
+    uint32_t result = 0;
+    while (isdigit(*p)) {
+        uint32_t digit = *p++ - '0';
+        if (result > (UINT32_MAX - digit) / 10) {
+            return false; // Overflow
+        }
+        result = result * 10 + digit;
+    }
     
-    if (ptr == end_ptr) {
+    if (p == ptr) {
         return false; // No digits found
     }
     
-    ptr = end_ptr;
+    value = result;
+    ptr = p;
     return true;
 }
 
-bool CommandParser::parse_button_name(const char*& ptr, char* button_name, size_t max_len) {
+// Hex digits only, without sign or "0x" prefix, for the same reason
+bool CommandParser::parse_hex_uint(const char*& ptr, uint32_t& value) {
     skip_whitespace(ptr);
     
-    size_t i = 0;
-    while (*ptr && !isspace(*ptr) && i < max_len - 1) {
-        button_name[i++] = tolower(*ptr++);
+    const char* p = ptr;
+    uint32_t result = 0;
+    while (isxdigit(*p)) {
+        if (result > (UINT32_MAX >> 4)) {
+            return false; // Overflow
+        }
+        uint8_t nibble = isdigit(*p) ? *p - '0' : tolower(*p) - 'a' + 10;
+        result = (result << 4) | nibble;
+        p++;
     }
-    button_name[i] = '\0';
     
-    return i > 0;
-}
\ No newline at end of file
+    if (p == ptr) {
+        return false; // No digits found
+    }
+    
+    value = result;
+    ptr = p;
+    return true;
+}
+
+// Optional trailing "<n>f" after a button list, in transmitted frames; args
+// may start at the count or anywhere before it
+bool CommandParser::parse_press_frames(const char* args, uint32_t& frames) {
+    frames = DEFAULT_PRESS_FRAMES;
+    const char* ptr = args;
+    while (*ptr && !isdigit(*ptr)) {
+        ptr++;
+    }
+    if (*ptr == '\0') {
+        return true;
+    }
+
+    if (!parse_uint(ptr, frames) || tolower(*ptr) != 'f') {
+        return false;
+    }
+    ptr++;
+    skip_whitespace(ptr);
+    return *ptr == '\0' && frames >= 1 && frames <= MAX_PRESS_FRAMES;
+}
+
+static void log_histogram(const char* name, const Histogram& h) {
+    FastLogger::log_fmt<LOG_PARSER, LOG_REPLY>("STATS %s n=%u p50=%u p90=%u p99=%u max=%u us", name,
+                                               (unsigned)h.count(), (unsigned)h.percentile(50),
+                                               (unsigned)h.percentile(90), (unsigned)h.percentile(99),
+                                               (unsigned)h.max());
+}
+
+CommandParser::Error CommandParser::stats_command(const char* args) {
+    static const char* const STAGE_NAMES[SwitchBluetooth::LATENCY_STAGES] = {"parse", "queue", "send",
+                                                                              "total"};
+    Token option;
+    if (next_token(args, option)) {
+        if (!option.is("RESET") || *args) {
+            FastLogger::log<LOG_PARSER, LOG_INFO>("Usage: STATS [RESET]");
+            return ERROR_BAD_ARGUMENT;
+        }
+        _switch->reset_stats();
+        FastLogger::log<LOG_PARSER, LOG_REPLY>("STATS RESET");
+        return ERROR_NONE;
+    }
+
+    for (int i = 0; i < SwitchBluetooth::LATENCY_STAGES; i++) {
+        log_histogram(STAGE_NAMES[i], _switch->latency((SwitchBluetooth::LatencyStage)i));
+    }
+
+    const SwitchBluetooth::HidStats& hid = _switch->hid_stats();
+    log_histogram("can_send_interval", hid.can_send_interval);
+    log_histogram("send_interval", hid.send_interval);
+    FastLogger::log_fmt<LOG_PARSER, LOG_REPLY>("STATS reports input=%u reply=%u late=%u",
+                                               (unsigned)hid.input_reports, (unsigned)hid.reply_reports,
+                                               (unsigned)hid.late_frames);
+    FastLogger::log_fmt<LOG_PARSER, LOG_REPLY>("STATS connect link=%u first_report=%u ms",
+                                               (unsigned)_switch->connect_ms(),
+                                               (unsigned)_switch->first_report_ms());
+    FastLogger::log_fmt<LOG_PARSER, LOG_REPLY>("STATS imu free=%u underruns=%u",
+                                               (unsigned)_switch->imu_stream().free_samples(),
+                                               (unsigned)_switch->imu_stream().underruns());
+    FastLogger::log_fmt<LOG_PARSER, LOG_REPLY>("STATS queue coalesced=%u applied=%u",
+                                               (unsigned)_switch->input_queue().coalesced_count(),
+                                               (unsigned)_switch->input_queue().applied_count());
+    FastLogger::log_fmt<LOG_PARSER, LOG_REPLY>("STATS snapshot retries=%u replaced=%u",
+                                               (unsigned)hid.snapshot_retries,
+                                               (unsigned)hid.snapshots_replaced);
+    FastLogger::log_fmt<LOG_PARSER, LOG_REPLY>("STATS serial overruns=%u high=%u",
+                                               (unsigned)SerialInput::overruns(),
+                                               (unsigned)SerialInput::high_water());
+    FastLogger::log_fmt<LOG_PARSER, LOG_REPLY>("STATS log dropped=%u high=%u",
+                                               (unsigned)FastLogger::dropped_count(),
+                                               (unsigned)FastLogger::high_water());
+    return ERROR_NONE;
+}
+
+CommandParser::Error CommandParser::bootstats_command() {
+    // Each reached phase with its time from reset and from the previous
+    // reached phase, so the step that dominates stands out
+    uint32_t previous = 0;
+    for (int i = 0; i < BootProfile::PHASES; i++) {
+        BootProfile::Phase phase = (BootProfile::Phase)i;
+        uint32_t at = BootProfile::at(phase);
+        if (at == 0) {
+            FastLogger::log_fmt<LOG_PARSER, LOG_REPLY>("BOOTSTATS %s -", BootProfile::name(phase));
+            continue;
+        }
+        FastLogger::log_fmt<LOG_PARSER, LOG_REPLY>("BOOTSTATS %s at=%u step=%u us", BootProfile::name(phase),
+                                                   (unsigned)at, (unsigned)(at - previous));
+        previous = at;
+    }
+    return ERROR_NONE;
+}
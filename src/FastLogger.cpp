@@ -2,103 +2,229 @@
 #include <cstring>
 #include <cstdio>
 #include <cstdarg>
+#include "pico/stdlib.h"
+#include "tusb.h"
 
 // Static member definitions
-char FastLogger::log_buffer[FastLogger::BUFFER_SIZE];
-volatile int FastLogger::write_pos = 0;
-volatile int FastLogger::read_pos = 0;
-volatile bool FastLogger::buffer_full = false;
+uint32_t FastLogger::log_buffer[FastLogger::BUFFER_SIZE / 4];
+volatile uint32_t FastLogger::reserve_pos = 0;
+volatile uint32_t FastLogger::read_pos = 0;
+volatile uint32_t FastLogger::dropped = 0;
+volatile uint32_t FastLogger::high_water_mark = 0;
+spin_lock_t* FastLogger::reserve_lock = nullptr;
+
+// Text handed to stdio per write; every record fits
+static constexpr int FLUSH_CHUNK = 256;
 
 void FastLogger::init() {
-    write_pos = 0;
+    reserve_lock = spin_lock_init(spin_lock_claim_unused(true));
+    reserve_pos = 0;
     read_pos = 0;
-    buffer_full = false;
-    memset(log_buffer, 0, BUFFER_SIZE);
+    dropped = 0;
+    high_water_mark = 0;
 }
 
 void FastLogger::log(const char* message) {
     // Fast non-blocking logging - just queue the message
-    add_message(message);
+    add_message(message, strlen(message));
 }
 
 void FastLogger::log_fmt(const char* format, ...) {
     char temp_buffer[MAX_MESSAGE_LEN];
-    
+
     va_list args;
     va_start(args, format);
-    vsnprintf(temp_buffer, sizeof(temp_buffer), format, args);
+    int length = vsnprintf(temp_buffer, sizeof(temp_buffer), format, args);
     va_end(args);
-    
-    add_message(temp_buffer);
+
+    if (length < 0) {
+        return;
+    }
+    add_message(temp_buffer, length);
 }
 
-void FastLogger::add_message(const char* message) {
-    int msg_len = strlen(message);
-    if (msg_len >= MAX_MESSAGE_LEN - 1) {
-        msg_len = MAX_MESSAGE_LEN - 2; // Leave room for newline and null terminator
+void FastLogger::log_event(LogId id, uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    uint32_t words[2 + LOG_MAX_ARGS] = {id, time_us_32(), arg0, arg1, arg2, arg3};
+    uint32_t length = EVENT_HEADER_SIZE + 4 * LOG_ARG_COUNTS.count[id];
+
+    uint32_t pos;
+    if (!reserve(length | EVENT, pos)) {
+        return;
     }
-    
-    // Calculate required space (message + newline + null terminator)
-    int required_space = msg_len + 2;
-    
-    // Check if we have enough space
-    int available_space;
-    if (write_pos >= read_pos) {
-        available_space = BUFFER_SIZE - write_pos + read_pos - 1;
-    } else {
-        available_space = read_pos - write_pos - 1;
+    copy_in(pos + 4, words, length);
+    commit(pos, length | EVENT);
+}
+
+void FastLogger::add_message(const char* message, int length) {
+    if (length > MAX_MESSAGE_LEN - 1) {
+        length = MAX_MESSAGE_LEN - 1;
     }
-    
-    if (required_space > available_space) {
-        buffer_full = true;
-        return; // Buffer full, drop message to avoid blocking
+
+    // The text and its newline
+    uint32_t text_length = length + 1;
+    uint32_t pos;
+    if (!reserve(text_length, pos)) {
+        return;
     }
-    
-    // Copy message to buffer
-    for (int i = 0; i < msg_len; i++) {
-        log_buffer[write_pos] = message[i];
-        write_pos = (write_pos + 1) % BUFFER_SIZE;
+    copy_in(pos + 4, message, length);
+    copy_in(pos + 4 + length, "\n", 1);
+    commit(pos, text_length);
+}
+
+// Header word, then the payload padded to a word
+static inline uint32_t record_size(uint32_t header) {
+    return 4 + (((header & 0xFFFF) + 3) & ~3u);
+}
+
+// Headers are shared with the flusher without a lock, so every access to
+// one goes to memory
+static inline volatile uint32_t& header_at(uint32_t* ring, uint32_t pos, uint32_t size) {
+    return reinterpret_cast<volatile uint32_t*>(ring)[(pos & (size - 1)) / 4];
+}
+
+bool FastLogger::reserve(uint32_t header, uint32_t& pos) {
+    uint32_t size = record_size(header);
+
+    // Only the reservation happens under the lock
+    uint32_t saved_irq = spin_lock_blocking(reserve_lock);
+    pos = reserve_pos;
+    uint32_t used = pos - read_pos + size;
+    if (used > BUFFER_SIZE) {
+        dropped = dropped + 1;
+        spin_unlock(reserve_lock, saved_irq);
+        return false; // Buffer full, drop message to avoid blocking
     }
-    
-    // Add newline
-    log_buffer[write_pos] = '\n';
-    write_pos = (write_pos + 1) % BUFFER_SIZE;
-    
-    // Add null terminator for current message
-    log_buffer[write_pos] = '\0';
-    write_pos = (write_pos + 1) % BUFFER_SIZE;
+    // The uncommitted header has to land before the record is published,
+    // or the flusher could take a committed header left from the last lap
+    header_at(log_buffer, pos, BUFFER_SIZE) = header;
+    __dmb();
+    reserve_pos = pos + size;
+    if (used > high_water_mark) {
+        high_water_mark = used;
+    }
+    spin_unlock(reserve_lock, saved_irq);
+    return true;
+}
+
+void FastLogger::commit(uint32_t pos, uint32_t header) {
+    // The payload must be visible before the record is marked committed
+    __dmb();
+    header_at(log_buffer, pos, BUFFER_SIZE) = header | COMMITTED;
 }
 
-bool FastLogger::get_next_message(char* output, int max_len) {
-    if (read_pos == write_pos && !buffer_full) {
-        return false; // No messages
+void FastLogger::copy_in(uint32_t pos, const void* data, uint32_t length) {
+    char* ring = reinterpret_cast<char*>(log_buffer);
+    const char* bytes = static_cast<const char*>(data);
+    uint32_t offset = pos & (BUFFER_SIZE - 1);
+    uint32_t first = BUFFER_SIZE - offset;
+    if (length <= first) {
+        memcpy(ring + offset, bytes, length);
+    } else {
+        memcpy(ring + offset, bytes, first);
+        memcpy(ring, bytes + first, length - first);
     }
-    
-    int msg_pos = 0;
-    while (read_pos != write_pos && msg_pos < max_len - 1) {
-        char c = log_buffer[read_pos];
-        read_pos = (read_pos + 1) % BUFFER_SIZE;
-        
-        if (c == '\0') {
-            break; // End of message
-        }
-        
-        output[msg_pos++] = c;
+}
+
+void FastLogger::copy_out(uint32_t pos, void* data, uint32_t length) {
+    const char* ring = reinterpret_cast<const char*>(log_buffer);
+    char* bytes = static_cast<char*>(data);
+    uint32_t offset = pos & (BUFFER_SIZE - 1);
+    uint32_t first = BUFFER_SIZE - offset;
+    if (length <= first) {
+        memcpy(bytes, ring + offset, length);
+    } else {
+        memcpy(bytes, ring + offset, first);
+        memcpy(bytes + first, ring, length - first);
+    }
+}
+
+// Writes the record at pos as it goes out on the wire and returns its length
+int FastLogger::render(uint32_t pos, uint32_t header, char* out) {
+    uint32_t length = header & LENGTH_MASK;
+
+#if SWITCH_BINARY_LOG
+    // Frame: sync, payload length, then the payload as stored minus padding
+    uint8_t* frame = reinterpret_cast<uint8_t*>(out);
+    frame[0] = LOG_FRAME_SYNC;
+    if (header & EVENT) {
+        frame[1] = length - 2;
+        copy_out(pos + 4, frame + 2, 2);
+        copy_out(pos + 8, frame + 4, length - 4);
+    } else {
+        // Text without its newline
+        frame[1] = length - 1 + 2;
+        frame[2] = LOG_TEXT_ID & 0xFF;
+        frame[3] = LOG_TEXT_ID >> 8;
+        copy_out(pos + 4, frame + 4, length - 1);
+    }
+    return frame[1] + 2;
+#else
+    if (!(header & EVENT)) {
+        copy_out(pos + 4, out, length);
+        return length;
+    }
+
+    uint32_t words[2 + LOG_MAX_ARGS] = {};
+    copy_out(pos + 4, words, length);
+    uint16_t id = words[0];
+    int text_length = snprintf(out, MAX_MESSAGE_LEN, LOG_FORMATS[id], words[2], words[3], words[4],
+                               words[5]);
+    if (text_length < 0) {
+        text_length = 0;
+    } else if (text_length > MAX_MESSAGE_LEN - 1) {
+        text_length = MAX_MESSAGE_LEN - 1;
     }
-    
-    output[msg_pos] = '\0';
-    buffer_full = false; // Clear full flag when we read a message
-    
-    return msg_pos > 0;
+    out[text_length] = '\n';
+    return text_length + 1;
+#endif
 }
 
-void FastLogger::flush_logs() {
-    char message[MAX_MESSAGE_LEN];
-    while (get_next_message(message, sizeof(message))) {
-        printf("%s", message); // Send to USB serial for web terminal
+void FastLogger::flush_logs(uint32_t budget_us) {
+    uint32_t start = time_us_32();
+    char chunk[FLUSH_CHUNK];
+    char record[MAX_MESSAGE_LEN + 4];
+
+    while (time_us_32() - start < budget_us) {
+        // Never hand stdio more than the CDC FIFO can take, or it blocks
+        uint32_t space = tud_cdc_write_available();
+        if (space > sizeof(chunk)) {
+            space = sizeof(chunk);
+        }
+
+        uint32_t fill = 0;
+        uint32_t output = 0;  // Bytes after CRLF translation
+        uint32_t pos = read_pos;
+        while (pos != reserve_pos) {
+            __dmb(); // Pairs with the barrier before reserve_pos is published
+            uint32_t header = header_at(log_buffer, pos, BUFFER_SIZE);
+            if (!(header & COMMITTED)) {
+                break; // Still being written
+            }
+            __dmb();
+
+            // Text records end in one newline, which stdio turns into CRLF
+            uint32_t length = render(pos, header, record);
+            uint32_t cost = SWITCH_BINARY_LOG ? length : length + 1;
+            if (output + cost > space) {
+                break;
+            }
+            memcpy(chunk + fill, record, length);
+            fill += length;
+            output += cost;
+            pos += record_size(header);
+        }
+
+        if (fill == 0) {
+            break;
+        }
+
+        // Hand the space back only once the text has been copied out
+        __dmb();
+        read_pos = pos;
+        stdio_put_string(chunk, fill, false, !SWITCH_BINARY_LOG);
     }
 }
 
 bool FastLogger::has_pending_logs() {
-    return read_pos != write_pos || buffer_full;
-}
\ No newline at end of file
+    return read_pos != reserve_pos;
+}
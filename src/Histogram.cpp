@@ -0,0 +1,35 @@
+#include "Histogram.h"
+#include <cstring>
+
+void Histogram::reset() {
+    memset(_counts, 0, sizeof(_counts));
+    _count = 0;
+    _max = 0;
+}
+
+uint32_t Histogram::bucket_max(int index) {
+    if (index < 8) {
+        return index;
+    }
+    int exponent = (index - 8) / 4 + 3;
+    uint32_t step = 1u << (exponent - 2);
+    return (4 + (index - 8) % 4) * step + step - 1;
+}
+
+uint32_t Histogram::percentile(uint32_t percent) const {
+    if (_count == 0) {
+        return 0;
+    }
+
+    // Smallest bucket that covers the requested share of samples
+    uint32_t target = ((uint64_t)_count * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += _counts[i];
+        if (seen >= target) {
+            uint32_t value = bucket_max(i);
+            return value < _max ? value : _max;
+        }
+    }
+    return _max;
+}
@@ -0,0 +1,57 @@
+#include "ImuStream.h"
+#include <cstring>
+#include "hardware/sync.h"
+
+// A controller lying still, sent until the host streams anything
+static constexpr uint8_t REST_SAMPLE[ImuStream::SAMPLE_SIZE] = {
+    0x75, 0xFD, 0xFD, 0xFF, 0x09, 0x10, 0x21, 0x00, 0xD5, 0xFF, 0xE0, 0xFF};
+
+ImuStream::ImuStream() {
+    memcpy(_last, REST_SAMPLE, sizeof(_last));
+}
+
+bool ImuStream::push(const uint8_t* samples, uint32_t count) {
+    if (count > free_samples()) {
+        return false;
+    }
+
+    // Only whole frames are handed over; a partial one waits for the rest
+    uint32_t written = _written;
+    for (uint32_t i = 0; i < count; i++) {
+        memcpy(&_frames[written & (CAPACITY - 1)][_slot * SAMPLE_SIZE], samples + i * SAMPLE_SIZE, SAMPLE_SIZE);
+        if (++_slot == SAMPLES_PER_FRAME) {
+            _slot = 0;
+            written++;
+        }
+    }
+
+    // Publish the frames before the consumer can see them
+    __dmb();
+    _written = written;
+    return true;
+}
+
+void ImuStream::pop_frame(uint8_t* out) {
+    uint32_t read = _read;
+    if (_written == read) {
+        for (uint32_t i = 0; i < SAMPLES_PER_FRAME; i++) {
+            memcpy(out + i * SAMPLE_SIZE, _last, SAMPLE_SIZE);
+        }
+        if constexpr (SWITCH_CONFIG.trace) {
+            if (_streaming) {
+                _underruns++;
+            }
+        }
+        return;
+    }
+
+    __dmb();
+    const uint8_t* frame = _frames[read & (CAPACITY - 1)];
+    memcpy(out, frame, FRAME_SIZE);
+    memcpy(_last, frame + FRAME_SIZE - SAMPLE_SIZE, SAMPLE_SIZE);
+    _streaming = true;
+
+    // Finish reading the frame before handing it back to the producer
+    __dmb();
+    _read = read + 1;
+}
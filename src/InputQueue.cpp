@@ -0,0 +1,112 @@
+#include "InputQueue.h"
+#include <cstring>
+
+void InputQueue::reset() {
+    memset(_set, 0, sizeof(_set));
+    memset(_clear, 0, sizeof(_clear));
+    memset(_frame_buttons, 0, sizeof(_frame_buttons));
+    memset(_step_buttons, 0, sizeof(_step_buttons));
+    _stick_pending = 0;
+    _step_sticks = 0;
+    _pending_count = 0;
+    _coalesced = 0;
+    _applied = 0;
+}
+
+bool InputQueue::push(const InputOp& op) {
+    if (op.type == InputOp::STICK_SET) {
+        uint8_t bit = 1 << op.index;
+        if (_stick_pending & bit) {
+            // Written before the boundary, must go out in its own frame first
+            if (!(_step_sticks & bit)) {
+                return false;
+            }
+            if constexpr (SWITCH_CONFIG.trace) {
+                _coalesced++;
+            }
+        } else {
+            _pending_count++;
+        }
+
+        _stick_h[op.index] = op.h;
+        _stick_v[op.index] = op.v;
+        _stick_pending |= bit;
+        _step_sticks |= bit;
+        return true;
+    }
+
+    uint8_t index = op.index;
+    if (_frame_buttons[index] & op.mask) {
+        if (!(_step_buttons[index] & op.mask)) {
+            return false;
+        }
+        if constexpr (SWITCH_CONFIG.trace) {
+            _coalesced++;
+        }
+    } else {
+        _pending_count++;
+    }
+
+    // Last write wins
+    if (op.type == InputOp::BUTTON_SET) {
+        _set[index] |= op.mask;
+        _clear[index] &= ~op.mask;
+    } else {
+        _clear[index] |= op.mask;
+        _set[index] &= ~op.mask;
+    }
+    _frame_buttons[index] |= op.mask;
+    _step_buttons[index] |= op.mask;
+    return true;
+}
+
+void InputQueue::mark_boundary() {
+    memset(_step_buttons, 0, sizeof(_step_buttons));
+    _step_sticks = 0;
+}
+
+void InputQueue::preview(SwitchReport& report, uint8_t dpad) const {
+    if (_pending_count > 0) {
+        write_pending(report, dpad);
+    }
+}
+
+int InputQueue::apply(SwitchReport& report, uint8_t& dpad) {
+    int applied = _pending_count;
+    if (applied == 0) {
+        return 0;
+    }
+
+    write_pending(report, dpad);
+    memset(_set, 0, sizeof(_set));
+    memset(_clear, 0, sizeof(_clear));
+    memset(_frame_buttons, 0, sizeof(_frame_buttons));
+    mark_boundary();
+    _stick_pending = 0;
+    _pending_count = 0;
+    if constexpr (SWITCH_CONFIG.trace) {
+        _applied += applied;
+    }
+    return applied;
+}
+
+void InputQueue::write_pending(SwitchReport& report, uint8_t& dpad) const {
+    for (int i = 0; i < BUTTON_INDEX_DPAD; i++) {
+        report.buttons[i] = (report.buttons[i] | _set[i]) & ~_clear[i];
+    }
+
+    if (_frame_buttons[BUTTON_INDEX_DPAD]) {
+        dpad = (dpad | _set[BUTTON_INDEX_DPAD]) & ~_clear[BUTTON_INDEX_DPAD];
+        report.buttons[2] = (report.buttons[2] & 0xF0) | ButtonTable::DPAD_TO_HAT.hat[dpad];
+    }
+
+    for (int i = 0; i < STICK_COUNT; i++) {
+        if (!(_stick_pending & (1 << i))) {
+            continue;
+        }
+        uint8_t *stick = (i == STICK_LEFT) ? report.l : report.r;
+        stick[0] = _stick_h[i] & 0xFF;
+        stick[1] = ((_stick_h[i] >> 8) & 0x0F) | ((_stick_v[i] & 0x0F) << 4);
+        stick[2] = (_stick_v[i] >> 4) & 0xFF;
+    }
+}
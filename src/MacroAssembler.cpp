@@ -0,0 +1,327 @@
+#include "MacroAssembler.h"
+#include <cstring>
+#include <cctype>
+#include "CommandParser.h"
+#include "FastLogger.h"
+
+// Longest wait a single WAIT_US can hold (24-bit operand)
+static constexpr uint32_t MAX_WAIT_US = 0xFFFFFF;
+
+uint32_t MacroAssembler::assemble(const char* text, uint32_t length, uint32_t* code, uint32_t capacity) {
+    _code = code;
+    _capacity = capacity;
+    _count = 0;
+    _line = 0;
+    _loop_depth = 0;
+    _label_count = 0;
+    _fixup_count = 0;
+
+    if (!emit(MacroVM::MAGIC)) {
+        return 0;
+    }
+
+    uint32_t pos = 0;
+    while (pos < length) {
+        // Stored text isn't terminated, so copy one line out at a time
+        char line[LINE_LEN];
+        size_t len = 0;
+        bool too_long = false;
+        while (pos < length) {
+            char c = text[pos++];
+            if (c == '\n' || c == '\r') {
+                break;
+            }
+            if (len < sizeof(line) - 1) {
+                line[len++] = c;
+            } else {
+                too_long = true;
+            }
+        }
+        line[len] = '\0';
+        _line++;
+
+        if (too_long) {
+            error("line too long");
+            return 0;
+        }
+        if (!assemble_line(line)) {
+            return 0;
+        }
+    }
+
+    if (_loop_depth != 0) {
+        error("LOOP without ENDLOOP");
+        return 0;
+    }
+    if (!emit(MacroVM::encode(MacroVM::OP_HALT))) {
+        return 0;
+    }
+
+    // Resolve forward references now that every label is known
+    for (int i = 0; i < _fixup_count; i++) {
+        Label& label = _labels[_fixups[i].label];
+        if (!label.defined) {
+            FastLogger::log_fmt<LOG_MACRO, LOG_ERROR>("Macro: undefined label %s", label.name);
+            return 0;
+        }
+        uint32_t& word = _code[_fixups[i].at];
+        if ((word & 0xFF) == MacroVM::OP_JNZ) {
+            word = (word & 0xFFFF) | (label.target << 16);
+        } else {
+            word = (word & 0xFF) | (label.target << 8);
+        }
+    }
+
+    return _count;
+}
+
+bool MacroAssembler::assemble_line(const char* line) {
+    const char* ptr = line;
+    CommandParser::skip_whitespace(ptr);
+    if (*ptr == '\0' || *ptr == '#') {
+        return true;
+    }
+
+    CommandParser::Token command;
+    CommandParser::next_token(ptr, command);
+
+    // "name:" defines a label at the next instruction
+    if (command.start[command.length - 1] == ':') {
+        int label = find_label(command.start, command.length - 1);
+        if (label < 0) {
+            return false;
+        }
+        if (_labels[label].defined) {
+            return error("label defined twice");
+        }
+        _labels[label].defined = true;
+        _labels[label].target = _count;
+        return CommandParser::at_end(ptr) || error("unexpected text after label");
+    }
+
+    if (!assemble_instruction(command.start, command.length, ptr)) {
+        return false;
+    }
+    // Operands have to take up the rest of the line
+    return CommandParser::at_end(ptr) || error("unexpected text after operands");
+}
+
+bool MacroAssembler::assemble_instruction(const char* start, size_t length, const char*& ptr) {
+    const CommandParser::Token command = {start, length};
+    if (command.is("PRESS")) {
+        // Down for the given frames (PRESS a 5f), then up
+        uint32_t frames;
+        if (!CommandParser::parse_press_frames(ptr, frames)) {
+            return error("usage: PRESS <buttons> [<1-255>f]");
+        }
+        const char* buttons = ptr;
+        if (!assemble_buttons(buttons, MacroVM::OP_BUTTON_DOWN) ||
+            !emit(MacroVM::encode(MacroVM::OP_WAIT_FRAMES, frames)) ||
+            !assemble_buttons(ptr, MacroVM::OP_BUTTON_UP)) {
+            return false;
+        }
+        // parse_press_frames already checked the frame count ends the line
+        ptr += strlen(ptr);
+        return true;
+    }
+    if (command.is("HOLD")) {
+        return assemble_buttons(ptr, MacroVM::OP_BUTTON_DOWN);
+    }
+    if (command.is("RELEASE")) {
+        return assemble_buttons(ptr, MacroVM::OP_BUTTON_UP);
+    }
+    if (command.is("STICK")) {
+        return assemble_stick(ptr);
+    }
+    if (command.is("SLEEP")) {
+        return assemble_sleep(ptr);
+    }
+    if (command.is("LOOP")) {
+        uint32_t count = 0;
+        if (!CommandParser::at_end(ptr) && !CommandParser::parse_uint(ptr, count)) {
+            return error("usage: LOOP [count]");
+        }
+        if (count > 0xFFFFFF) {
+            return error("loop count too large");
+        }
+        _loop_depth++;
+        if (_loop_depth > MacroVM::LOOP_DEPTH) {
+            return error("loops nested too deep");
+        }
+        return emit(MacroVM::encode(MacroVM::OP_LOOP, count));
+    }
+    if (command.is("ENDLOOP")) {
+        if (_loop_depth == 0) {
+            return error("ENDLOOP without LOOP");
+        }
+        _loop_depth--;
+        return emit(MacroVM::encode(MacroVM::OP_ENDLOOP));
+    }
+    if (command.is("JUMP")) {
+        return assemble_branch(ptr, MacroVM::OP_JUMP, 0);
+    }
+    if (command.is("HALT")) {
+        return emit(MacroVM::encode(MacroVM::OP_HALT));
+    }
+
+    // Counter instructions
+    uint8_t counter;
+    if (command.is("SET")) {
+        uint32_t value;
+        if (!parse_counter(ptr, counter) || !CommandParser::parse_uint(ptr, value) || value > 0xFFFF) {
+            return error("usage: SET <counter> <0-65535>");
+        }
+        return emit(MacroVM::encode(MacroVM::OP_SET, counter, (uint16_t)value));
+    }
+    if (command.is("INC") || command.is("DEC")) {
+        if (!parse_counter(ptr, counter)) {
+            return error("expected a counter c0-c7");
+        }
+        MacroVM::Opcode op = command.is("INC") ? MacroVM::OP_INC : MacroVM::OP_DEC;
+        return emit(MacroVM::encode(op, counter, 0));
+    }
+    if (command.is("JNZ")) {
+        if (!parse_counter(ptr, counter)) {
+            return error("expected a counter c0-c7");
+        }
+        return assemble_branch(ptr, MacroVM::OP_JNZ, counter);
+    }
+
+    FastLogger::log_fmt<LOG_MACRO, LOG_ERROR>("Macro line %u: unknown command %.*s", (unsigned)_line,
+                                              (int)command.length, command.start);
+    return false;
+}
+
+bool MacroAssembler::assemble_buttons(const char*& ptr, MacroVM::Opcode op) {
+    // Buttons sharing a report byte become a single instruction
+    uint8_t masks[BUTTON_INDEX_DPAD + 1] = {0};
+    CommandParser::Token name;
+    bool any = false;
+    CommandParser::skip_whitespace(ptr);
+    while (!isdigit(*ptr) && CommandParser::next_token(ptr, name)) {
+        any = true;
+        ButtonMask button;
+        if (!ButtonTable::lookup(name.start, name.length, button)) {
+            FastLogger::log_fmt<LOG_MACRO, LOG_ERROR>("Macro line %u: unknown button %.*s", (unsigned)_line,
+                                                      (int)name.length, name.start);
+            return false;
+        }
+        masks[button.index] |= button.mask;
+    }
+    if (!any) {
+        return error("expected a button");
+    }
+
+    for (uint8_t i = 0; i <= BUTTON_INDEX_DPAD; i++) {
+        if (masks[i] && !emit(MacroVM::encode(op, i, masks[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MacroAssembler::assemble_stick(const char*& ptr) {
+    CommandParser::Token name;
+    uint8_t stick;
+    int32_t h, v;
+    if (!CommandParser::next_token(ptr, name) || !ButtonTable::lookup_stick(name.start, name.length, stick) ||
+        !CommandParser::parse_fixed(ptr, h, InputOp::STICK_DECIMALS) ||
+        !CommandParser::parse_fixed(ptr, v, InputOp::STICK_DECIMALS)) {
+        return error("usage: STICK <left|right> <h> <v>");
+    }
+
+    uint32_t raw = InputOp::stick_axis_to_raw(h) | ((uint32_t)InputOp::stick_axis_to_raw(v) << 12);
+    return emit(MacroVM::encode(stick == STICK_LEFT ? MacroVM::OP_STICK_L : MacroVM::OP_STICK_R, raw));
+}
+
+bool MacroAssembler::assemble_sleep(const char*& ptr) {
+    uint64_t us;
+    if (!CommandParser::parse_seconds_us(ptr, us)) {
+        return error("usage: SLEEP <seconds>");
+    }
+
+    // Microsecond resolution where it fits, milliseconds beyond ~16 s
+    if (us <= MAX_WAIT_US) {
+        return emit(MacroVM::encode(MacroVM::OP_WAIT_US, (uint32_t)us));
+    }
+    uint64_t ms = us / 1000;
+    if (ms > 0xFFFFFF) {
+        return error("sleep too long");
+    }
+    return emit(MacroVM::encode(MacroVM::OP_WAIT_MS, (uint32_t)ms));
+}
+
+bool MacroAssembler::assemble_branch(const char*& ptr, MacroVM::Opcode op, uint8_t counter) {
+    CommandParser::Token name;
+    if (!CommandParser::next_token(ptr, name)) {
+        return error("expected a label");
+    }
+    int label = find_label(name.start, name.length);
+    if (label < 0) {
+        return false;
+    }
+    if (_fixup_count >= MAX_FIXUPS) {
+        return error("too many branches");
+    }
+
+    // Targets are patched in once the whole text has been read
+    _fixups[_fixup_count].at = _count;
+    _fixups[_fixup_count].label = label;
+    _fixup_count++;
+    return emit(MacroVM::encode(op, counter, 0));
+}
+
+bool MacroAssembler::parse_counter(const char*& ptr, uint8_t& counter) {
+    CommandParser::skip_whitespace(ptr);
+    if (tolower(ptr[0]) != 'c' || ptr[1] < '0' || ptr[1] >= '0' + MacroVM::COUNTERS ||
+        (ptr[2] && !isspace(ptr[2]))) {
+        return false;
+    }
+    counter = ptr[1] - '0';
+    ptr += 2;
+    return true;
+}
+
+// Labels are matched without regard to case
+int MacroAssembler::find_label(const char* name, size_t length) {
+    if (length == 0 || length >= LABEL_LEN) {
+        error("label must be 1-15 characters");
+        return -1;
+    }
+    for (int i = 0; i < _label_count; i++) {
+        const char* known = _labels[i].name;
+        size_t j = 0;
+        while (j < length && known[j] == ButtonTable::to_lower(name[j])) {
+            j++;
+        }
+        if (j == length && known[j] == '\0') {
+            return i;
+        }
+    }
+    if (_label_count >= MAX_LABELS) {
+        error("too many labels");
+        return -1;
+    }
+
+    Label& label = _labels[_label_count];
+    for (size_t j = 0; j < length; j++) {
+        label.name[j] = ButtonTable::to_lower(name[j]);
+    }
+    label.name[length] = '\0';
+    label.target = 0;
+    label.defined = false;
+    return _label_count++;
+}
+
+bool MacroAssembler::emit(uint32_t word) {
+    if (_count >= _capacity) {
+        return error("program too large");
+    }
+    _code[_count++] = word;
+    return true;
+}
+
+bool MacroAssembler::error(const char* message) {
+    FastLogger::log_fmt<LOG_MACRO, LOG_ERROR>("Macro line %u: %s", (unsigned)_line, message);
+    return false;
+}
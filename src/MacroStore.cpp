@@ -0,0 +1,402 @@
+#include "MacroStore.h"
+#include <cstring>
+#include "FastLogger.h"
+#include "hardware/flash.h"
+#include "pico/btstack_flash_bank.h"
+#include "pico/flash.h"
+#include "pico/stdlib.h"
+
+static constexpr uint32_t RECORD_MAGIC = 0x4F52434D;  // "MCRO"
+static constexpr uint32_t STATE_COMMITTED = 0;
+static constexpr uint32_t EMPTY_SLOT = 0xFFFFFFFF;
+
+// The store sits directly below BTstack's TLV flash bank at the end of flash
+static constexpr uint32_t REGION_OFFSET = PICO_FLASH_BANK_STORAGE_OFFSET - MacroStore::STORE_SIZE;
+static_assert(REGION_OFFSET % FLASH_SECTOR_SIZE == 0, "Macro store must be sector aligned");
+
+// End of the firmware image in flash, from the linker script
+extern char __flash_binary_end;
+
+static const uint8_t* region() {
+    return (const uint8_t*)(XIP_BASE + REGION_OFFSET);
+}
+
+static uint32_t round_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+// Header page plus the data pages of a record
+static uint32_t record_span(uint32_t length) {
+    return FLASH_PAGE_SIZE + round_up(length, FLASH_PAGE_SIZE);
+}
+
+struct FlashOp {
+    uint32_t offset;
+    const uint8_t* data;
+    uint32_t count;
+};
+
+static void flash_erase_op(void* param) {
+    FlashOp* op = (FlashOp*)param;
+    flash_range_erase(op->offset, op->count);
+}
+
+static void flash_program_op(void* param) {
+    FlashOp* op = (FlashOp*)param;
+    flash_range_program(op->offset, op->data, op->count);
+}
+
+// Flash writes stall XIP, so the other core and interrupts are held off
+static bool run_flash_op(void (*func)(void*), uint32_t offset, const uint8_t* data, uint32_t count) {
+    FlashOp op = {REGION_OFFSET + offset, data, count};
+    return flash_safe_execute(func, &op, 100) == PICO_OK;
+}
+
+struct Crc32Table {
+    uint32_t entry[256];
+};
+
+static constexpr Crc32Table build_crc32_table() {
+    Crc32Table table = {};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        table.entry[i] = crc;
+    }
+    return table;
+}
+
+static constexpr Crc32Table CRC32_TABLE = build_crc32_table();
+
+uint32_t MacroStore::crc32(const uint8_t* data, uint32_t length, uint32_t crc) {
+    crc = ~crc;
+    for (uint32_t i = 0; i < length; i++) {
+        crc = CRC32_TABLE.entry[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void MacroStore::init() {
+    _preparing = false;
+    _receiving = false;
+
+    // A large enough image would run into the store and be overwritten by
+    // the first upload or erase, so the store is left unused instead
+    uint32_t image_end = (uint32_t)((uintptr_t)&__flash_binary_end - XIP_BASE);
+    _available = image_end <= REGION_OFFSET;
+    if (!_available) {
+        for (int i = 0; i < MAX_SLOTS; i++) {
+            _slot_offset[i] = EMPTY_SLOT;
+        }
+        _log_end = STORE_SIZE;
+        FastLogger::log_fmt<LOG_STORE, LOG_ERROR>("Macro store disabled: firmware ends at %08x, store starts at %08x",
+                                                  (unsigned)image_end, (unsigned)REGION_OFFSET);
+        return;
+    }
+    scan();
+}
+
+const MacroStore::RecordHeader* MacroStore::header_at(uint32_t offset) {
+    return (const RecordHeader*)(region() + offset);
+}
+
+void MacroStore::scan() {
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        _slot_offset[i] = EMPTY_SLOT;
+    }
+
+    // Walk the log; aborted uploads are skipped using their declared length
+    uint32_t offset = 0;
+    while (offset + FLASH_PAGE_SIZE <= STORE_SIZE) {
+        const RecordHeader* header = header_at(offset);
+        if (header->magic != RECORD_MAGIC || header->length_check != ~header->length ||
+            record_span(header->length) > STORE_SIZE - offset) {
+            break;
+        }
+        if (header->state == STATE_COMMITTED && header->slot < MAX_SLOTS) {
+            _slot_offset[header->slot] = offset;
+        }
+        offset += record_span(header->length);
+    }
+
+    // The rest of the current sector is only reused if it is still erased
+    uint32_t sector_end = round_up(offset, FLASH_SECTOR_SIZE);
+    _log_end = offset;
+    for (uint32_t i = offset; i < sector_end; i++) {
+        if (region()[i] != 0xFF) {
+            _log_end = sector_end;
+            break;
+        }
+    }
+    _erased_until = sector_end;
+}
+
+// Only pages begin_upload has had erased are ever programmed
+bool MacroStore::program_page(uint32_t offset, const uint8_t* data) {
+    if (offset >= _erased_until) {
+        return false;
+    }
+    return run_flash_op(flash_program_op, offset, data, FLASH_PAGE_SIZE);
+}
+
+bool MacroStore::erase_sector(uint32_t offset) {
+    return run_flash_op(flash_erase_op, offset, nullptr, FLASH_SECTOR_SIZE);
+}
+
+bool MacroStore::begin_upload(uint32_t slot, uint32_t length) {
+    if (!_available || _preparing || _receiving || is_erasing() || slot >= MAX_SLOTS || length == 0) {
+        FastLogger::log<LOG_STORE, LOG_REPLY>("NAK UPLOAD");
+        return false;
+    }
+    if (record_span(length) > STORE_SIZE - _log_end) {
+        FastLogger::log<LOG_STORE, LOG_REPLY>("NAK FULL");
+        return false;
+    }
+
+    // Reserve the record's extent up front; an aborted upload is skipped whole
+    _upload_slot = slot;
+    _upload_offset = _log_end;
+    _upload_length = length;
+    _log_end += record_span(length);
+
+    // poll() erases whatever sectors the record reaches into, then says READY
+    _received = 0;
+    _preparing = true;
+    return true;
+}
+
+void MacroStore::start_receiving() {
+    _preparing = false;
+
+    // The header goes out uncommitted now and is committed once all data is in
+    memset(_page, 0xFF, sizeof(_page));
+    RecordHeader* header = (RecordHeader*)_page;
+    header->magic = RECORD_MAGIC;
+    header->length = _upload_length;
+    header->length_check = ~_upload_length;
+    header->slot = _upload_slot;
+    if (!program_page(_upload_offset, _page)) {
+        FastLogger::log<LOG_STORE, LOG_REPLY>("NAK FLASH");
+        return;
+    }
+
+    _write_offset = _upload_offset + FLASH_PAGE_SIZE;
+    _page_fill = 0;
+    _upload_crc = 0;
+    _state = SYNC;
+    _last_byte_us = time_us_64();
+    _receiving = true;
+
+    FastLogger::log_event<LOG_UPLOAD_READY>(_upload_slot, _upload_length);
+}
+
+void MacroStore::receive(uint8_t byte) {
+    _last_byte_us = time_us_64();
+
+    switch (_state) {
+        case SYNC:
+            if (byte == CHUNK_SYNC) {
+                _state = OFFSET;
+                _field_pos = 0;
+                _chunk_offset = 0;
+                _chunk_length = 0;
+                _chunk_crc = 0;
+            }
+            break;
+        case OFFSET:
+            _chunk_offset |= (uint32_t)byte << (8 * _field_pos);
+            if (++_field_pos == 4) {
+                _state = LENGTH;
+                _field_pos = 0;
+            }
+            break;
+        case LENGTH:
+            _chunk_length |= (uint16_t)(byte << (8 * _field_pos));
+            if (++_field_pos == 2) {
+                if (_chunk_length == 0 || _chunk_length > MAX_CHUNK) {
+                    FastLogger::log_event<LOG_UPLOAD_NAK_LENGTH>(_received);
+                    _state = SYNC;
+                } else {
+                    _state = CRC;
+                    _field_pos = 0;
+                }
+            }
+            break;
+        case CRC:
+            _chunk_crc |= (uint32_t)byte << (8 * _field_pos);
+            if (++_field_pos == 4) {
+                _state = DATA;
+                _field_pos = 0;
+            }
+            break;
+        case DATA:
+            _chunk[_field_pos++] = byte;
+            if (_field_pos == _chunk_length) {
+                end_chunk();
+            }
+            break;
+    }
+}
+
+void MacroStore::end_chunk() {
+    _state = SYNC;
+
+    if (crc32(_chunk, _chunk_length) != _chunk_crc) {
+        FastLogger::log_event<LOG_UPLOAD_NAK_CRC>(_received);
+        return;
+    }
+
+    // Resent chunk after a lost ACK
+    if (_chunk_offset + _chunk_length <= _received) {
+        FastLogger::log_event<LOG_UPLOAD_ACK>(_received);
+        return;
+    }
+    if (_chunk_offset != _received || _chunk_length > _upload_length - _received) {
+        FastLogger::log_event<LOG_UPLOAD_NAK_OFFSET>(_received);
+        return;
+    }
+
+    if (!append(_chunk, _chunk_length)) {
+        abort_upload("FLASH");
+        return;
+    }
+    _received += _chunk_length;
+    _upload_crc = crc32(_chunk, _chunk_length, _upload_crc);
+    FastLogger::log_event<LOG_UPLOAD_ACK>(_received);
+
+    if (_received == _upload_length && !finish_upload()) {
+        abort_upload("FLASH");
+    }
+}
+
+bool MacroStore::append(const uint8_t* data, uint32_t length) {
+    while (length > 0) {
+        uint32_t count = FLASH_PAGE_SIZE - _page_fill;
+        if (count > length) {
+            count = length;
+        }
+        memcpy(_page + _page_fill, data, count);
+        _page_fill += count;
+        data += count;
+        length -= count;
+
+        if (_page_fill == FLASH_PAGE_SIZE) {
+            if (!program_page(_write_offset, _page)) {
+                return false;
+            }
+            _write_offset += FLASH_PAGE_SIZE;
+            _page_fill = 0;
+        }
+    }
+    return true;
+}
+
+bool MacroStore::finish_upload() {
+    if (_page_fill > 0) {
+        memset(_page + _page_fill, 0xFF, FLASH_PAGE_SIZE - _page_fill);
+        if (!program_page(_write_offset, _page)) {
+            return false;
+        }
+    }
+
+    // Committing only clears bits, so the header page is programmed in place
+    memset(_page, 0xFF, sizeof(_page));
+    RecordHeader* header = (RecordHeader*)_page;
+    header->magic = RECORD_MAGIC;
+    header->state = STATE_COMMITTED;
+    header->length = _upload_length;
+    header->length_check = ~_upload_length;
+    header->crc = _upload_crc;
+    header->slot = _upload_slot;
+    if (!program_page(_upload_offset, _page)) {
+        return false;
+    }
+
+    _slot_offset[_upload_slot] = _upload_offset;
+    _receiving = false;
+    FastLogger::log_event<LOG_UPLOAD_DONE>(_upload_slot, _upload_length, _upload_crc);
+    return true;
+}
+
+void MacroStore::abort_upload(const char* reason) {
+    _receiving = false;
+    FastLogger::log_fmt<LOG_STORE, LOG_REPLY>("NAK %u %s", (unsigned)_received, reason);
+}
+
+void MacroStore::poll() {
+    if (_receiving && time_us_64() - _last_byte_us > RECEIVE_TIMEOUT_US) {
+        abort_upload("TIMEOUT");
+    }
+
+    // An upload's sectors are erased one per poll, in log order, before
+    // its first chunk is accepted
+    if (_preparing) {
+        if (_erased_until < _log_end) {
+            if (!erase_sector(_erased_until)) {
+                return; // Retried on the next poll
+            }
+            _erased_until += FLASH_SECTOR_SIZE;
+        }
+        if (_erased_until >= _log_end) {
+            start_receiving();
+        }
+    }
+
+    // One sector per poll, last first: the head of the log goes only once
+    // everything after it is gone, so an interrupted erase leaves a
+    // readable log
+    if (is_erasing()) {
+        uint32_t sector = _erase_pos - FLASH_SECTOR_SIZE;
+        if (!erase_sector(sector)) {
+            return; // Retried on the next poll
+        }
+        _erase_pos = sector;
+        if (!is_erasing()) {
+            scan();
+            _erased_until = STORE_SIZE;
+            FastLogger::log<LOG_STORE, LOG_REPLY>("ERASED");
+        }
+    }
+}
+
+bool MacroStore::find(uint32_t slot, const uint8_t*& data, uint32_t& length) {
+    if (slot >= MAX_SLOTS || _slot_offset[slot] == EMPTY_SLOT) {
+        return false;
+    }
+
+    const RecordHeader* header = header_at(_slot_offset[slot]);
+    data = region() + _slot_offset[slot] + FLASH_PAGE_SIZE;
+    length = header->length;
+
+    if (crc32(data, length) != header->crc) {
+        FastLogger::log_event<LOG_MACRO_CORRUPTED>(slot);
+        return false;
+    }
+    return true;
+}
+
+void MacroStore::list() {
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        if (_slot_offset[i] != EMPTY_SLOT) {
+            FastLogger::log_event<LOG_STORE_SLOT>(i, header_at(_slot_offset[i])->length);
+        }
+    }
+    FastLogger::log_event<LOG_STORE_FREE>(STORE_SIZE - _log_end);
+}
+
+void MacroStore::erase_all() {
+    if (!_available) {
+        FastLogger::log<LOG_STORE, LOG_REPLY>("NAK STORE");
+        return;
+    }
+    if (_preparing || _receiving) {
+        _preparing = false;
+        abort_upload("ERASED");
+    }
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        _slot_offset[i] = EMPTY_SLOT;
+    }
+    _erase_pos = STORE_SIZE;
+}
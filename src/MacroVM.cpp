@@ -0,0 +1,204 @@
+#include "MacroVM.h"
+#include <cstring>
+#include "hardware/sync.h"
+#include "pico/stdlib.h"
+#include "FastLogger.h"
+
+// Falling this far behind (e.g. while disconnected) restarts the clock
+// instead of replaying every missed wait back to back
+static constexpr uint64_t MAX_CATCH_UP_US = 1000000;
+
+bool MacroVM::start(const uint32_t* program, uint32_t words, uint32_t runs) {
+    if (words < 2 || program[0] != MAGIC) {
+        FastLogger::log<LOG_MACRO, LOG_ERROR>("Not a macro program");
+        return false;
+    }
+
+    stop();
+    _code = program;
+    _length = words;
+    _pc = 1;
+    _runs = runs;
+    memset(_counters, 0, sizeof(_counters));
+    _loop_depth = 0;
+    _waiting_frames = false;
+    _clock_started = false;
+
+    // Publish the program before the frame loop can see it running
+    __dmb();
+    _running = true;
+    return true;
+}
+
+void MacroVM::stop() {
+    _running = false;
+    __dmb();
+    while (_busy) {
+        tight_loop_contents();
+    }
+}
+
+void MacroVM::fault(const char* reason) {
+    FastLogger::log_fmt<LOG_MACRO, LOG_ERROR>("Macro stopped at %u: %s", (unsigned)_pc, reason);
+    _running = false;
+}
+
+void MacroVM::run_frame(uint64_t now_us, uint32_t frame, InputQueue& queue, StickMotion& motion) {
+    _busy = true;
+    __dmb();
+    if (!_running) {
+        _busy = false;
+        return;
+    }
+
+    if (!_clock_started || now_us > _clock_us + MAX_CATCH_UP_US) {
+        _clock_us = now_us;
+        _clock_started = true;
+    }
+
+    for (int steps = 0; steps < STEPS_PER_FRAME && _running; steps++) {
+        // Pending waits are checked before fetching the next instruction
+        if (_waiting_frames) {
+            if ((int32_t)(frame - _wait_frame) < 0) {
+                break;
+            }
+            _waiting_frames = false;
+            _clock_us = now_us;
+        }
+        if (_clock_us > now_us) {
+            break;
+        }
+
+        if (_pc >= _length) {
+            fault("ran off the end");
+            break;
+        }
+
+        uint32_t insn = _code[_pc];
+        uint32_t operand = insn >> 8;
+        uint8_t a = (insn >> 8) & 0xFF;
+        uint16_t b = insn >> 16;
+        bool stalled = false;
+
+        switch ((Opcode)(insn & 0xFF)) {
+            case OP_HALT:
+                if (_runs == 1) {
+                    FastLogger::log_event<LOG_MACRO_FINISHED>();
+                    _running = false;
+                } else {
+                    if (_runs > 1) {
+                        _runs--;
+                    }
+                    _pc = 1;
+                    _loop_depth = 0;
+                    // The next pass is a new step, like an implicit wait
+                    queue.mark_boundary();
+                }
+                continue;
+
+            case OP_BUTTON_DOWN:
+            case OP_BUTTON_UP:
+                if (a > BUTTON_INDEX_DPAD) {
+                    fault("bad button index");
+                    continue;
+                }
+                // A control this frame already changed waits for the next one
+                stalled = !queue.push(InputOp::button({a, (uint8_t)b},
+                                                      (insn & 0xFF) == OP_BUTTON_DOWN));
+                break;
+
+            case OP_STICK_L:
+            case OP_STICK_R: {
+                InputOp op;
+                op.type = InputOp::STICK_SET;
+                op.index = (insn & 0xFF) == OP_STICK_L ? STICK_LEFT : STICK_RIGHT;
+                op.mask = 0;
+                op.h = operand & 0xFFF;
+                op.v = operand >> 12;
+                stalled = !queue.push(op);
+                if (!stalled) {
+                    motion.stop(op.index);
+                }
+                break;
+            }
+
+            case OP_WAIT_US:
+                _clock_us += operand;
+                queue.mark_boundary();
+                break;
+
+            case OP_WAIT_MS:
+                _clock_us += (uint64_t)operand * 1000;
+                queue.mark_boundary();
+                break;
+
+            case OP_WAIT_FRAMES:
+                _wait_frame = frame + operand;
+                _waiting_frames = true;
+                queue.mark_boundary();
+                break;
+
+            case OP_LOOP:
+                if (_loop_depth >= LOOP_DEPTH) {
+                    fault("loops nested too deep");
+                    continue;
+                }
+                _loops[_loop_depth].start = _pc + 1;
+                _loops[_loop_depth].remaining = operand;
+                _loop_depth++;
+                break;
+
+            case OP_ENDLOOP: {
+                if (_loop_depth == 0) {
+                    fault("ENDLOOP without LOOP");
+                    continue;
+                }
+                Loop& loop = _loops[_loop_depth - 1];
+                if (loop.remaining == 0 || --loop.remaining > 0) {
+                    _pc = loop.start;
+                    continue;
+                }
+                _loop_depth--;
+                break;
+            }
+
+            case OP_JUMP:
+                _pc = operand;
+                continue;
+
+            case OP_SET:
+            case OP_INC:
+            case OP_DEC:
+            case OP_JNZ: {
+                if (a >= COUNTERS) {
+                    fault("bad counter");
+                    continue;
+                }
+                uint8_t op = insn & 0xFF;
+                if (op == OP_SET) {
+                    _counters[a] = b;
+                } else if (op == OP_INC) {
+                    _counters[a]++;
+                } else if (op == OP_DEC) {
+                    _counters[a]--;
+                } else if (_counters[a] != 0) {
+                    _pc = b;
+                    continue;
+                }
+                break;
+            }
+
+            default:
+                fault("bad opcode");
+                continue;
+        }
+
+        if (stalled) {
+            break;
+        }
+        _pc++;
+    }
+
+    __dmb();
+    _busy = false;
+}
@@ -0,0 +1,61 @@
+#include "RumbleDecoder.h"
+#include "FastLogger.h"
+
+// 2^(i/32) in Q16; band frequencies are 10 Hz * 2^(code/32)
+static const uint32_t FREQUENCY_STEPS[32] = {
+    65536, 66971, 68438, 69936, 71468, 73032, 74632, 76266,
+    77936, 79642, 81386, 83169, 84990, 86851, 88752, 90696,
+    92682, 94711, 96785, 98905, 101070, 103283, 105545, 107856,
+    110218, 112631, 115098, 117618, 120194, 122825, 125515, 128263};
+
+static uint16_t frequency_hz(uint8_t code) {
+    return (uint16_t)(((10 * FREQUENCY_STEPS[code & 31] << (code >> 5)) + 0x8000) >> 16);
+}
+
+// Byte 0 and bit 0 of byte 1: high band frequency, in steps of 4 from code 0x60
+// Bits 1-7 of byte 1: high band amplitude
+// Bits 0-6 of byte 2: low band frequency, from code 0x40
+// Bit 7 of byte 2 and byte 3 (from 0x40): low band amplitude
+RumbleDecoder::State RumbleDecoder::decode(const uint8_t* side) {
+    State state;
+    uint16_t hf = ((side[1] & 0x01) << 8) | side[0];
+    state.hf_hz = frequency_hz((hf >> 2) + 0x60);
+    state.hf_amp = side[1] >> 1;
+    state.lf_hz = frequency_hz((side[2] & 0x7F) + 0x40);
+    state.lf_amp = side[3] < 0x40 ? 0 : ((side[3] - 0x40) << 1) | (side[2] >> 7);
+    return state;
+}
+
+void RumbleDecoder::reset() {
+    // The console's neutral pattern: 320 Hz and 160 Hz, both silent
+    static const uint8_t NEUTRAL[4] = {0x00, 0x01, 0x40, 0x40};
+    for (int side = 0; side < 2; side++) {
+        _sent[side] = decode(NEUTRAL);
+        _sent_us[side] = 0;
+    }
+}
+
+void RumbleDecoder::update(const uint8_t* data, uint32_t now_us) {
+    for (int side = 0; side < 2; side++) {
+        State state = decode(data + side * 4);
+        State& sent = _sent[side];
+        if (state.hf_hz == sent.hf_hz && state.lf_hz == sent.lf_hz && state.hf_amp == sent.hf_amp &&
+            state.lf_amp == sent.lf_amp) {
+            continue;
+        }
+
+        bool active = state.hf_amp || state.lf_amp;
+        bool was_active = sent.hf_amp || sent.lf_amp;
+        if (active == was_active && now_us - _sent_us[side] < HOLDOFF_US) {
+            continue;
+        }
+
+        if (side == 0) {
+            FastLogger::log_event<LOG_RUMBLE_LEFT>(state.hf_hz, state.hf_amp, state.lf_hz, state.lf_amp);
+        } else {
+            FastLogger::log_event<LOG_RUMBLE_RIGHT>(state.hf_hz, state.hf_amp, state.lf_hz, state.lf_amp);
+        }
+        sent = state;
+        _sent_us[side] = now_us;
+    }
+}
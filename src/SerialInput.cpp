@@ -0,0 +1,120 @@
+#include "SerialInput.h"
+#include "FastLogger.h"
+#include "pico/stdio_usb.h"
+#include "pico/stdlib.h"
+
+#include <string.h>
+
+uint8_t SerialInput::_buffer[BUFFER_SIZE + MAX_LINE + 1];
+uint32_t SerialInput::_write = 0;
+uint32_t SerialInput::_read = 0;
+uint32_t SerialInput::_scan = 0;
+bool SerialInput::_discarding = false;
+SerialInput::Stamp SerialInput::_stamps[STAMPS];
+uint32_t SerialInput::_stamp_head = 0;
+uint32_t SerialInput::_stamp_tail = 0;
+uint32_t SerialInput::_overruns = 0;
+uint32_t SerialInput::_high_water = 0;
+
+uint32_t SerialInput::receive(uint32_t budget) {
+    uint32_t start = _write;
+    uint32_t now = time_us_32();
+
+    while (budget > 0) {
+        uint32_t offset = _write & (BUFFER_SIZE - 1);
+        uint32_t space = BUFFER_SIZE - (_write - _read);
+        uint32_t length = BUFFER_SIZE - offset;  // Up to the end of the ring
+        if (length > space) {
+            length = space;
+        }
+        if (length > budget) {
+            length = budget;
+        }
+        if (length == 0) {
+            break;
+        }
+
+        // The USB driver's bulk read: tud_cdc_read under stdio's USB lock,
+        // so it can't race the background USB task
+        int count = stdio_usb.in_chars((char*)_buffer + offset, (int)length);
+        if (count <= 0) {
+            break;
+        }
+        _write += count;
+        budget -= count;
+    }
+
+    uint32_t count = _write - start;
+    if (count == 0) {
+        return 0;
+    }
+    // With every stamp in use the new bytes share the previous read's
+    // stamp, which only overstates their wait
+    if (_stamp_head - _stamp_tail < STAMPS) {
+        _stamps[_stamp_head++ % STAMPS] = {start, now};
+    }
+    if (_write - _read > _high_water) {
+        _high_water = _write - _read;
+    }
+    return count;
+}
+
+uint32_t SerialInput::read_time(uint32_t pos) {
+    while (_stamp_head - _stamp_tail > 1 && (int32_t)(pos - _stamps[(_stamp_tail + 1) % STAMPS].pos) >= 0) {
+        _stamp_tail++;
+    }
+    return _stamps[_stamp_tail % STAMPS].us;
+}
+
+const char* SerialInput::next_line(uint32_t& received_us, uint32_t& dropped) {
+    dropped = 0;
+    while (_scan != _write) {
+        uint8_t c = _buffer[_scan++ & (BUFFER_SIZE - 1)];
+
+        if (c != '\n' && c != '\r') {
+            if (_discarding) {
+                _read = _scan;
+            } else if (_scan - _read > MAX_LINE) {
+                // Too long to hand out; drop it whole rather than run its
+                // tail as a command of its own
+                _discarding = true;
+                _read = _scan;
+                _overruns++;
+                dropped++;
+                FastLogger::log_event<LOG_LINE_TOO_LONG>(MAX_LINE);
+            }
+            continue;
+        }
+
+        uint32_t start = _read;
+        uint32_t length = _scan - 1 - start;
+        _read = _scan;
+        if (_discarding) {
+            _discarding = false;
+            continue;
+        }
+        if (length == 0) {
+            continue;
+        }
+
+        uint32_t offset = start & (BUFFER_SIZE - 1);
+        if (offset + length > BUFFER_SIZE) {
+            memcpy(_buffer + BUFFER_SIZE, _buffer, offset + length - BUFFER_SIZE);
+        }
+        _buffer[offset + length] = '\0';
+        received_us = read_time(start);
+        return (const char*)_buffer + offset;
+    }
+    return nullptr;
+}
+
+bool SerialInput::read_byte(uint8_t& byte) {
+    if (_read == _write) {
+        return false;
+    }
+    byte = _buffer[_read++ & (BUFFER_SIZE - 1)];
+    if ((int32_t)(_scan - _read) < 0) {
+        _scan = _read;
+    }
+    return true;
+}
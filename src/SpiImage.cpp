@@ -0,0 +1,110 @@
+#include "SpiImage.h"
+#include <cstring>
+#include "hardware/sync.h"
+
+// Factory IMU calibration
+static constexpr uint8_t IMU_CALIBRATION[24] = {
+    0xCC, 0x00, 0x40, 0x00, 0x91, 0x01, 0x00, 0x40, 0x00, 0x40, 0x00, 0x40,
+    0xE7, 0xFF, 0x0E, 0x00, 0xDC, 0xFF, 0x3B, 0x34, 0x3B, 0x34, 0x3B, 0x34};
+
+// Factory stick calibration, left then right
+static constexpr uint8_t STICK_CALIBRATION[18] = {
+    0xD4, 0x75, 0x61, 0xE5, 0x87, 0x7C, 0xEC, 0x55, 0x61,
+    0x5D, 0xD8, 0x7F, 0x18, 0xE6, 0x61, 0x86, 0x65, 0x5D};
+
+static constexpr uint8_t COLOURS[6] = {
+    (SWITCH_BODY_COLOR >> 16) & 0xFF, (SWITCH_BODY_COLOR >> 8) & 0xFF, SWITCH_BODY_COLOR & 0xFF,
+    (SWITCH_BUTTON_COLOR >> 16) & 0xFF, (SWITCH_BUTTON_COLOR >> 8) & 0xFF, SWITCH_BUTTON_COLOR & 0xFF};
+
+// IMU horizontal offsets
+static constexpr uint8_t IMU_HORIZONTAL[6] = {0x50, 0xFD, 0x00, 0x00, 0xC6, 0x0F};
+
+// Stick parameters, the same for both sticks
+static constexpr uint8_t STICK_PARAMETERS[18] = {
+    0x0F, 0x30, 0x61, 0x96, 0x30, 0xF3, 0xD4, 0x14, 0x54,
+    0x41, 0x15, 0x54, 0xC7, 0x79, 0x9C, 0x33, 0x36, 0x63};
+
+// Sorted by address, no overlaps
+static constexpr SpiImage::Range RANGES[] = {
+    {0x6020, sizeof(IMU_CALIBRATION), IMU_CALIBRATION},
+    {0x603D, sizeof(STICK_CALIBRATION), STICK_CALIBRATION},
+    {0x6050, sizeof(COLOURS), COLOURS},
+    {0x6080, sizeof(IMU_HORIZONTAL), IMU_HORIZONTAL},
+    {0x6086, sizeof(STICK_PARAMETERS), STICK_PARAMETERS},
+    {0x6098, sizeof(STICK_PARAMETERS), STICK_PARAMETERS},
+};
+static constexpr int RANGE_COUNT = sizeof(RANGES) / sizeof(RANGES[0]);
+
+static constexpr bool ranges_sorted() {
+    for (int i = 1; i < RANGE_COUNT; i++) {
+        if (RANGES[i - 1].address + RANGES[i - 1].length > RANGES[i].address) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(ranges_sorted(), "SPI ranges must be sorted and must not overlap");
+
+// Copy the part of [src_address, src_address + src_length) that falls in the read
+static void overlay(uint32_t address, uint8_t *out, uint8_t length,
+                    uint32_t src_address, const uint8_t *src, uint8_t src_length) {
+    uint32_t start = src_address > address ? src_address : address;
+    uint32_t end = address + length;
+    if (src_address + src_length < end) {
+        end = src_address + src_length;
+    }
+    if (start < end) {
+        memcpy(out + (start - address), src + (start - src_address), end - start);
+    }
+}
+
+void SpiImage::read(uint32_t address, uint8_t *out, uint8_t length) const {
+    memset(out, 0xFF, length);
+
+    // First range that ends after the read starts
+    int lo = 0;
+    int hi = RANGE_COUNT;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (RANGES[mid].address + RANGES[mid].length <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    uint32_t end = address + length;
+    for (int i = lo; i < RANGE_COUNT && RANGES[i].address < end; i++) {
+        overlay(address, out, length, RANGES[i].address, RANGES[i].data, RANGES[i].length);
+    }
+
+    for (int i = 0; i < _patch_count; i++) {
+        overlay(address, out, length, _patches[i].address, _patches[i].data, _patches[i].length);
+    }
+}
+
+bool SpiImage::patch(uint32_t address, const uint8_t *data, uint8_t length) {
+    if (length == 0 || length > MAX_PATCH_LEN) {
+        return false;
+    }
+
+    int index = 0;
+    while (index < _patch_count && _patches[index].address != address) {
+        index++;
+    }
+    if (index == MAX_PATCHES) {
+        return false;
+    }
+
+    Patch &patch = _patches[index];
+    patch.address = address;
+    patch.length = length;
+    memcpy(patch.data, data, length);
+
+    // Publish a new patch only once its bytes are in place
+    if (index == _patch_count) {
+        __dmb();
+        _patch_count = _patch_count + 1;
+    }
+    return true;
+}
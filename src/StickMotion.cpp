@@ -0,0 +1,115 @@
+#include "StickMotion.h"
+
+// One turn of sine in Q15, built at compile time so no float math is left
+// in the firmware. Lookups interpolate between neighbouring entries.
+static constexpr int SINE_ENTRIES = 256;
+
+struct SineTable {
+    int16_t values[SINE_ENTRIES];
+};
+
+static constexpr SineTable build_sine_table() {
+    constexpr double PI = 3.14159265358979323846;
+    SineTable table = {};
+    for (int i = 0; i < SINE_ENTRIES; i++) {
+        // Fold into [-pi/2, pi/2], where the Taylor series converges quickly
+        double x = 2 * PI * i / SINE_ENTRIES;
+        if (x > 3 * PI / 2) {
+            x -= 2 * PI;
+        } else if (x > PI / 2) {
+            x = PI - x;
+        }
+        double term = x;
+        double sum = x;
+        for (int n = 1; n < 12; n++) {
+            term *= -x * x / ((2 * n) * (2 * n + 1));
+            sum += term;
+        }
+        double scaled = sum * 32767;
+        table.values[i] = (int16_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    }
+    return table;
+}
+
+static constexpr SineTable SINE_TABLE = build_sine_table();
+
+int32_t StickMotion::sine(uint32_t phase) {
+    uint32_t index = phase >> 24;
+    int32_t frac = (phase >> 16) & 0xFF;
+    int32_t a = SINE_TABLE.values[index];
+    int32_t b = SINE_TABLE.values[(index + 1) & (SINE_ENTRIES - 1)];
+    return a + (((b - a) * frac) >> 8);
+}
+
+static uint16_t clamp_axis(int32_t raw) {
+    if (raw < SWITCH_JOYSTICK_MIN) return SWITCH_JOYSTICK_MIN;
+    if (raw > SWITCH_JOYSTICK_MAX) return SWITCH_JOYSTICK_MAX;
+    return (uint16_t)raw;
+}
+
+// Raw offset from the centre scaled by a Q15 sine
+static uint16_t wave(uint16_t amplitude, int32_t sine) {
+    return clamp_axis(SWITCH_JOYSTICK_MID + ((amplitude * sine) >> 15));
+}
+
+void StickMotion::start(const InputOp& op) {
+    Motion& motion = _motions[op.index];
+    motion.kind = (Kind)op.mask;
+    motion.frames = op.frames;
+    motion.h = op.h;
+    motion.v = op.v;
+    motion.step = 0;
+    motion.phase = 0;
+    // One turn every `frames` steps; rounding drifts by under a step per turn
+    motion.phase_step = (uint32_t)((((uint64_t)1 << 32) + op.frames / 2) / op.frames);
+    _active |= 1 << op.index;
+}
+
+void StickMotion::run_frame(const SwitchReport& report, InputQueue& queue) {
+    for (uint8_t stick = 0; stick < 2; stick++) {
+        if (!(_active & (1 << stick))) {
+            continue;
+        }
+        Motion& motion = _motions[stick];
+
+        uint16_t h, v;
+        switch (motion.kind) {
+            case MOTION_RAMP: {
+                if (motion.step == 0) {
+                    const uint8_t* raw = stick == STICK_LEFT ? report.l : report.r;
+                    motion.start_h = raw[0] | ((raw[1] & 0x0F) << 8);
+                    motion.start_v = (raw[1] >> 4) | (raw[2] << 4);
+                }
+                int32_t done = motion.step + 1;
+                h = motion.start_h + ((int32_t)motion.h - motion.start_h) * done / motion.frames;
+                v = motion.start_v + ((int32_t)motion.v - motion.start_v) * done / motion.frames;
+                break;
+            }
+            case MOTION_CIRCLE:
+            case MOTION_CIRCLE_CW: {
+                int32_t s = sine(motion.phase);
+                h = wave(motion.h, sine(motion.phase + 0x40000000));
+                v = wave(motion.h, motion.kind == MOTION_CIRCLE ? s : -s);
+                break;
+            }
+            default: {  // MOTION_OSC
+                int32_t s = sine(motion.phase);
+                h = wave(motion.h, s);
+                v = wave(motion.v, s);
+                break;
+            }
+        }
+
+        // A stick the frame already set in this step keeps that position;
+        // the motion picks up where it was on the next frame
+        InputOp op = {InputOp::STICK_SET, stick, 0, h, v, 0};
+        if (!queue.push(op)) {
+            continue;
+        }
+        motion.step++;
+        motion.phase += motion.phase_step;
+        if (motion.kind == MOTION_RAMP && motion.step >= motion.frames) {
+            stop(stick);
+        }
+    }
+}
@@ -1,6 +1,7 @@
 #define __BTSTACK_FILE__ "SwitchBluetooth.cpp"
 
 #include "SwitchBluetooth.h"
+#include "BootProfile.h"
 #include "FastLogger.h"
 
 #include <inttypes.h>
@@ -12,6 +13,7 @@
 #include "btstack.h"
 #include "btstack_event.h"
 #include "btstack_run_loop.h"
+#include "hardware/sync.h"
 #include "pico/cyw43_arch.h"
 #include "pico/rand.h"
 #include "pico/stdlib.h"
@@ -24,26 +26,25 @@ void SwitchBluetooth::init() {
   _switchReport.batteryConnection = 0x80;
   
   // Initialize Bluetooth timing control
-  _last_hid_report_time = 0;
-  _pending_report_update = false;
+  _last_can_send_us = 0;
+  _last_send_us = 0;
   
   // Initialize command queue
-  _queue_head = 0;
-  _queue_tail = 0;
-  _queue_full = false;
+  _input_queue.reset();
   _consolidation_active = false;
-  
-  bd_addr_t newAddr = {0x7c,
-                       0xbb,
-                       0x8a,
-                       (uint8_t)(get_rand_32() % 0xff),
-                       (uint8_t)(get_rand_32() % 0xff),
-                       (uint8_t)(get_rand_32() % 0xff)};
-  memcpy(_addr, newAddr, 6);
+  _dpad = 0;
+  _timeline.reset();
+  _frame_counter = 0;
+  _rumble.reset();
+  publish_snapshot();
   
   if (cyw43_arch_init()) {
     return;
   }
+  BootProfile::mark(BootProfile::RADIO_READY);
+
+  // The TLV store is up once the radio is initialised
+  load_identity();
 
   gap_discoverable_control(1);
   gap_set_class_of_device(0x2508);
@@ -61,28 +62,140 @@ void SwitchBluetooth::init() {
   // HID Device - use simplified initialization
   hid_device_init(0, sizeof(switch_bt_report_descriptor),
                   switch_bt_report_descriptor);
+  BootProfile::mark(BootProfile::STACK_READY);
+}
+
+// The radio is ready for another report
+void SwitchBluetooth::mark_can_send() {
+    if constexpr (SWITCH_CONFIG.trace) {
+        uint32_t now = time_us_32();
+        if (_last_can_send_us != 0) {
+            _hid_stats.can_send_interval.record(now - _last_can_send_us);
+        }
+        _last_can_send_us = now;
+    }
+}
+
+// Reuse the address from the previous boot, so the console and the link key
+// it holds still recognise us; only a blank store gets a fresh one
+void SwitchBluetooth::load_identity() {
+  const btstack_tlv_t *tlv = nullptr;
+  void *context = nullptr;
+  btstack_tlv_get_instance(&tlv, &context);
+
+  if (tlv == nullptr || tlv->get_tag(context, TLV_TAG_ADDRESS, _addr, sizeof(_addr)) != sizeof(_addr)) {
+    bd_addr_t newAddr = {0x7c,
+                         0xbb,
+                         0x8a,
+                         (uint8_t)(get_rand_32() % 0xff),
+                         (uint8_t)(get_rand_32() % 0xff),
+                         (uint8_t)(get_rand_32() % 0xff)};
+    memcpy(_addr, newAddr, 6);
+    if (tlv != nullptr) {
+      tlv->store_tag(context, TLV_TAG_ADDRESS, _addr, sizeof(_addr));
+    }
+  }
+
+  _console_known = tlv != nullptr &&
+                   tlv->get_tag(context, TLV_TAG_CONSOLE, _console, sizeof(_console)) == sizeof(_console);
+}
+
+// Page the console we were last connected to; it accepts with the stored
+// link key, skipping the pairing menu. We stay discoverable in case it
+// doesn't answer.
+void SwitchBluetooth::reconnect() {
+  if (!_console_known || _hid_cid != 0) {
+    return;
+  }
+  FastLogger::log_event<LOG_RECONNECTING>();
+  uint16_t hid_cid;
+  uint8_t status = hid_device_connect(_console, &hid_cid);
+  if (status) {
+    FastLogger::log_event<LOG_RECONNECT_FAILED>(status);
+  }
 }
 
-// Bluetooth timing control for 125Hz HID rate (8ms minimum interval)
-bool SwitchBluetooth::can_send_hid_report() {
-    uint32_t current_time = to_ms_since_boot(get_absolute_time());
-    return (current_time - _last_hid_report_time) >= 8; // 8ms = 125Hz
+// Flash is only written when the console changes
+void SwitchBluetooth::remember_console(const bd_addr_t console) {
+  if (_console_known && memcmp(_console, console, sizeof(_console)) == 0) {
+    return;
+  }
+  memcpy(_console, console, sizeof(_console));
+  _console_known = true;
+
+  const btstack_tlv_t *tlv = nullptr;
+  void *context = nullptr;
+  btstack_tlv_get_instance(&tlv, &context);
+  if (tlv != nullptr) {
+    tlv->store_tag(context, TLV_TAG_CONSOLE, _console, sizeof(_console));
+  }
+}
+
+void SwitchBluetooth::setHidCid(uint16_t hid_cid) {
+    uint32_t now = time_us_32();
+    if (hid_cid != 0) {
+        _connect_ms = (now - _link_down_us) / 1000;
+        _first_report_pending = true;
+    } else if (_hid_cid != 0) {
+        // Connect times count from boot or from losing a working link
+        _link_down_us = now;
+        _first_report_pending = false;
+    }
+    _hid_cid = hid_cid;
+    _connected_us = now;
+    _rumble.reset();
+    _last_can_send_us = 0;
+    _last_send_us = 0;
 }
 
 void SwitchBluetooth::mark_report_sent() {
-    _last_hid_report_time = to_ms_since_boot(get_absolute_time());
-    _pending_report_update = false;
+    if constexpr (SWITCH_CONFIG.trace) {
+        uint32_t now = time_us_32();
+        uint32_t interval = now - _last_send_us;
+        bool first = _last_send_us == 0;
+        _last_send_us = now;
+        if (!first) {
+            _hid_stats.send_interval.record(interval);
+        }
+
+        if (_report[1] == 0x21) {
+            _hid_stats.reply_reports++;
+        } else {
+            _hid_stats.input_reports++;
+        }
+
+        // Per frame, on the first report that carries it
+        if (_taken.frame != _sent_frame) {
+            _sent_frame = _taken.frame;
+            if (!first && _taken.changed && interval > LATE_FRAME_US) {
+                _hid_stats.late_frames++;
+            }
+            // Skip events queued before this connection
+            if (_taken.traced && (int32_t)(_taken.queued_us - _connected_us) >= 0) {
+                _latency[LATENCY_SEND].record(now - _taken.queued_us);
+                _latency[LATENCY_TOTAL].record(now - _taken.origin_us);
+            }
+        }
+    }
 }
 
-void SwitchBluetooth::wait_for_hid_transmission() {
-    // Non-blocking wait - only check if enough time has passed
-    // Actual transmission timing is handled by the BTStack event system
-    // This eliminates blocking sleep calls that interfere with macro timing
+void SwitchBluetooth::reset_stats() {
+    for (int i = 0; i < LATENCY_STAGES; i++) {
+        _latency[i].reset();
+    }
+    _hid_stats.can_send_interval.reset();
+    _hid_stats.send_interval.reset();
+    _hid_stats.input_reports = 0;
+    _hid_stats.reply_reports = 0;
+    _hid_stats.late_frames = 0;
+    _hid_stats.snapshot_retries = 0;
+    _hid_stats.snapshots_replaced = 0;
+    _input_queue.reset_stats();
+    _imu_stream.reset_stats();
 }
 
 void SwitchBluetooth::start_consolidation() {
     _consolidation_active = true;
-    _consolidation_start_time = to_ms_since_boot(get_absolute_time());
 }
 
 void SwitchBluetooth::end_consolidation() {
@@ -91,305 +204,274 @@ void SwitchBluetooth::end_consolidation() {
     process_command_queue();
 }
 
-void SwitchBluetooth::queue_button_command(const char* button, bool pressed) {
-    if (_queue_full) {
-        FastLogger::log("Command queue full - dropping command");
-        return;
-    }
-    
-    // Add command to queue
-    QueuedCommand& cmd = _command_queue[_queue_tail];
-    cmd.type = pressed ? QueuedCommand::BUTTON_PRESS : QueuedCommand::BUTTON_RELEASE;
-    strncpy(cmd.button_name, button, sizeof(cmd.button_name) - 1);
-    cmd.button_name[sizeof(cmd.button_name) - 1] = '\0';
-    cmd.pressed = pressed;
-    
-    _queue_tail = (_queue_tail + 1) % MAX_QUEUE_SIZE;
-    if (_queue_tail == _queue_head) {
-        _queue_full = true;
-    }
-    
-    // If not consolidating, process immediately
-    if (!_consolidation_active) {
-        process_command_queue();
+bool SwitchBluetooth::queue_op(const InputOp& op) {
+    // Motions write their first position when the frame steps
+    if (op.type == InputOp::STICK_MOTION) {
+        _stick_motion.start(op);
+        return true;
     }
-}
 
-void SwitchBluetooth::queue_stick_command(const char* stick, float h, float v) {
-    if (_queue_full) {
-        FastLogger::log("Command queue full - dropping stick command");
-        return;
+    // Later writes to the same control replace the pending one
+    if (!_input_queue.push(op)) {
+        return false;
     }
-    
-    // Add stick command to queue
-    QueuedCommand& cmd = _command_queue[_queue_tail];
-    cmd.type = QueuedCommand::STICK_SET;
-    strncpy(cmd.button_name, stick, sizeof(cmd.button_name) - 1);
-    cmd.button_name[sizeof(cmd.button_name) - 1] = '\0';
-    cmd.stick_h = h;
-    cmd.stick_v = v;
-    
-    _queue_tail = (_queue_tail + 1) % MAX_QUEUE_SIZE;
-    if (_queue_tail == _queue_head) {
-        _queue_full = true;
+    // Setting a stick outright ends any motion running on it
+    if (op.type == InputOp::STICK_SET) {
+        _stick_motion.stop(op.index);
     }
     
     // If not consolidating, process immediately
     if (!_consolidation_active) {
         process_command_queue();
     }
+    return true;
 }
 
+// Publish the frame being built, pending writes included, to the send path
 void SwitchBluetooth::process_command_queue() {
-    bool state_changed = false;
-    int commands_processed = 0;
-    
-    // Process all queued commands
-    while (_queue_head != _queue_tail || _queue_full) {
-        QueuedCommand& cmd = _command_queue[_queue_head];
-        
-        if (cmd.type == QueuedCommand::BUTTON_PRESS || cmd.type == QueuedCommand::BUTTON_RELEASE) {
-            // Apply button command directly to report state
-            bool pressed = (cmd.type == QueuedCommand::BUTTON_PRESS);
-            set_button_direct(cmd.button_name, pressed);
-            state_changed = true;
-            commands_processed++;
-        } else if (cmd.type == QueuedCommand::STICK_SET) {
-            // Apply stick command directly to report state
-            set_stick_direct(cmd.button_name, cmd.stick_h, cmd.stick_v);
-            state_changed = true;
-            commands_processed++;
+    publish_snapshot();
+}
+
+bool SwitchBluetooth::has_queued_commands() {
+    return !_input_queue.is_empty();
+}
+
+// Producer side: start a new frame once the previous one has gone out, move
+// every timeline event that is due by now and whatever the running macro
+// program writes into it, and publish it if anything changed
+void SwitchBluetooth::play_due_events() {
+    uint64_t now = time_us_64();
+    const Timeline::Event* event;
+
+    // Without a connection nothing takes snapshots; every call is a frame
+    if (_hid_cid == 0 || frame_taken()) {
+        commit_frame();
+    }
+    bool changed = !_frame_published;
+
+    start_consolidation();
+    while ((event = _timeline.peek_due(now)) != nullptr) {
+        // Frame-counted holds wait here, and everything behind them with them
+        if (_frame_counter - _step_frame < event->after_frames) {
+            break;
+        }
+        // Events with a later due time belong to a later step; a control that
+        // an earlier step changed must reach the console before it changes again
+        if (event->due_us != _step_due_us) {
+            _input_queue.mark_boundary();
+            _step_due_us = event->due_us;
         }
-        
-        _queue_head = (_queue_head + 1) % MAX_QUEUE_SIZE;
-        _queue_full = false;
+        if (!queue_op(event->op)) {
+            break;
+        }
+        if constexpr (SWITCH_CONFIG.trace) {
+            trace_queued(*event, (uint32_t)now);
+        }
+        // A frame-counted release is a step of its own, so a press of the
+        // same button right behind it still goes out a frame later
+        if (event->after_frames) {
+            _step_due_us = 0;
+        }
+        _timeline.pop();
+        _step_frame = _frame_counter;
+        changed = true;
     }
-    
-    // Log consolidation for debugging
-    if (commands_processed > 1) {
-        FastLogger::log_fmt("Consolidated %d commands into single frame", commands_processed);
+
+    // The macro program and stick motions step once per frame, as a step of
+    // their own after the events due when the frame started
+    if (!_vm_stepped) {
+        _input_queue.mark_boundary();
+        _vm.run_frame(now, _frame_counter, _input_queue, _stick_motion);
+        if (_stick_motion.is_active()) {
+            _stick_motion.run_frame(_switchReport, _input_queue);
+        }
+        _vm_stepped = true;
+        _step_due_us = 0;
     }
-    
-    // Only mark for transmission if state actually changed
-    if (state_changed) {
-        _pending_report_update = true;
+    _consolidation_active = false;
+
+    if (changed) {
+        publish_snapshot();
     }
 }
 
-bool SwitchBluetooth::has_queued_commands() {
-    return (_queue_head != _queue_tail) || _queue_full;
+// The send path has copied a snapshot of the frame being built
+bool SwitchBluetooth::frame_taken() {
+    return _frame_published && (int32_t)(_taken_seq - _frame_first_seq) >= 0;
 }
 
-// Optimized button control method with command queuing
-void SwitchBluetooth::set_button(const char* button, bool pressed) {
-    // Queue the command for frame consolidation
-    queue_button_command(button, pressed);
-}
+// Fold the sent frame into the report state and start the next one
+void SwitchBluetooth::commit_frame() {
+    int commands_processed = _input_queue.apply(_switchReport, _dpad);
 
-// Direct button state modification (used by queue processor)
-void SwitchBluetooth::set_button_direct(const char* button, bool pressed) {
-    
-    // Use a hash-like approach with first character for faster lookup
-    switch (button[0]) {
-        case 'a':
-            if (button[1] == '\0') { // "a"
-                if (pressed) _switchReport.buttons[0] |= SWITCH_MASK_A;
-                else _switchReport.buttons[0] &= ~SWITCH_MASK_A;
-            }
-            break;
-        case 'b':
-            if (button[1] == '\0') { // "b"
-                if (pressed) _switchReport.buttons[0] |= SWITCH_MASK_B;
-                else _switchReport.buttons[0] &= ~SWITCH_MASK_B;
-            }
-            break;
-        case 'x':
-            if (button[1] == '\0') { // "x"
-                if (pressed) _switchReport.buttons[0] |= SWITCH_MASK_X;
-                else _switchReport.buttons[0] &= ~SWITCH_MASK_X;
-            }
-            break;
-        case 'y':
-            if (button[1] == '\0') { // "y"
-                if (pressed) _switchReport.buttons[0] |= SWITCH_MASK_Y;
-                else _switchReport.buttons[0] &= ~SWITCH_MASK_Y;
-            }
-            break;
-        case 'l':
-            if (button[1] == '\0') { // "l"
-                if (pressed) _switchReport.buttons[2] |= SWITCH_MASK_L;
-                else _switchReport.buttons[2] &= ~SWITCH_MASK_L;
-            } else if (button[1] == '_' && button[2] == 's') { // "l_stick"
-                if (pressed) _switchReport.buttons[1] |= SWITCH_MASK_L3;
-                else _switchReport.buttons[1] &= ~SWITCH_MASK_L3;
-            }
-            break;
-        case 'r':
-            if (button[1] == '\0') { // "r"
-                if (pressed) _switchReport.buttons[0] |= SWITCH_MASK_R;
-                else _switchReport.buttons[0] &= ~SWITCH_MASK_R;
-            } else if (button[1] == '_' && button[2] == 's') { // "r_stick"
-                if (pressed) _switchReport.buttons[1] |= SWITCH_MASK_R3;
-                else _switchReport.buttons[1] &= ~SWITCH_MASK_R3;
-            }
-            break;
-        case 'z':
-            if (button[1] == 'l') { // "zl"
-                if (pressed) _switchReport.buttons[2] |= SWITCH_MASK_ZL;
-                else _switchReport.buttons[2] &= ~SWITCH_MASK_ZL;
-            } else if (button[1] == 'r') { // "zr"
-                if (pressed) _switchReport.buttons[0] |= SWITCH_MASK_ZR;
-                else _switchReport.buttons[0] &= ~SWITCH_MASK_ZR;
-            }
-            break;
-        case 'p':
-            if (button[1] == 'l') { // "plus"
-                if (pressed) _switchReport.buttons[1] |= SWITCH_MASK_PLUS;
-                else _switchReport.buttons[1] &= ~SWITCH_MASK_PLUS;
-            }
-            break;
-        case 'm':
-            if (button[1] == 'i') { // "minus"
-                if (pressed) _switchReport.buttons[1] |= SWITCH_MASK_MINUS;
-                else _switchReport.buttons[1] &= ~SWITCH_MASK_MINUS;
-            }
-            break;
-        case 'h':
-            if (button[1] == 'o') { // "home"
-                if (pressed) _switchReport.buttons[1] |= SWITCH_MASK_HOME;
-                else _switchReport.buttons[1] &= ~SWITCH_MASK_HOME;
-            }
-            break;
-        case 'c':
-            if (button[1] == 'a') { // "capture"
-                if (pressed) _switchReport.buttons[1] |= SWITCH_MASK_CAPTURE;
-                else _switchReport.buttons[1] &= ~SWITCH_MASK_CAPTURE;
-            }
-            break;
-        case 'd':
-            if (pressed) {
-                if (button[5] == 'u') { // "dpad_up"
-                    _switchReport.buttons[2] = (_switchReport.buttons[2] & 0xF0) | SWITCH_HAT_UP;
-                } else if (button[5] == 'd') { // "dpad_down"
-                    _switchReport.buttons[2] = (_switchReport.buttons[2] & 0xF0) | SWITCH_HAT_DOWN;
-                } else if (button[5] == 'l') { // "dpad_left"
-                    _switchReport.buttons[2] = (_switchReport.buttons[2] & 0xF0) | SWITCH_HAT_LEFT;
-                } else if (button[5] == 'r') { // "dpad_right"
-                    _switchReport.buttons[2] = (_switchReport.buttons[2] & 0xF0) | SWITCH_HAT_RIGHT;
-                }
-            } else {
-                _switchReport.buttons[2] = (_switchReport.buttons[2] & 0xF0) | SWITCH_HAT_NOTHING;
-            }
-            break;
+    // Log consolidation for debugging
+    if (commands_processed > 1) {
+        FastLogger::log_event<LOG_CONSOLIDATED>(commands_processed);
     }
+
+    _frame_counter++;
+    _frame_published = false;
+    _vm_stepped = false;
+    _step_due_us = 0;
+    _frame_traced = false;
 }
 
-void SwitchBluetooth::set_stick(const char* stick, float h, float v) {
-    // Queue the command for frame consolidation
-    queue_stick_command(stick, h, v);
+void SwitchBluetooth::publish_snapshot() {
+    uint32_t seq = _publish_seq + 1;
+
+    // Announce the slot first so a reader still copying it retries
+    _write_seq = seq;
+    __dmb();
+
+    InputSnapshot &snapshot = _snapshots[seq & 1];
+    snapshot.report = _switchReport;
+    _input_queue.preview(snapshot.report, _dpad);
+    snapshot.frame = _frame_counter;
+    snapshot.changed = !_input_queue.is_empty();
+    snapshot.traced = _frame_traced;
+    snapshot.origin_us = _frame_origin_us;
+    snapshot.queued_us = _frame_queued_us;
+
+    __dmb();
+    _publish_seq = seq;
+
+    if (!_frame_published) {
+        _frame_published = true;
+        _frame_first_seq = seq;
+    }
 }
 
-// Direct stick state modification (used by queue processor)
-void SwitchBluetooth::set_stick_direct(const char* stick, float h, float v) {
-    
-    // Convert from [-1.0, 1.0] to [0x000, 0xFFF] range
-    uint16_t h_val = (uint16_t)((h + 1.0f) * 0x7FF);
-    uint16_t v_val = (uint16_t)((v + 1.0f) * 0x7FF);
-    
-    // Clamp values
-    if (h_val > 0xFFF) h_val = 0xFFF;
-    if (v_val > 0xFFF) v_val = 0xFFF;
-    
-    // Optimized stick selection using first character
-    if (stick[0] == 'l') { // "l_stick"
-        _switchReport.l[0] = h_val & 0xFF;
-        _switchReport.l[1] = ((h_val >> 8) & 0x0F) | ((v_val & 0x0F) << 4);
-        _switchReport.l[2] = (v_val >> 4) & 0xFF;
-    } else if (stick[0] == 'r') { // "r_stick"
-        _switchReport.r[0] = h_val & 0xFF;
-        _switchReport.r[1] = ((h_val >> 8) & 0x0F) | ((v_val & 0x0F) << 4);
-        _switchReport.r[2] = (v_val >> 4) & 0xFF;
+// Send path: copy the latest complete snapshot in O(1). A retry is only
+// needed if the producer published twice while it was being copied.
+void SwitchBluetooth::take_snapshot() {
+    uint32_t seq;
+    uint32_t attempts = 0;
+    do {
+        seq = _publish_seq;
+        __dmb();
+        _taken = _snapshots[seq & 1];
+        __dmb();
+        attempts++;
+    } while (_write_seq - seq >= 2);
+
+    if constexpr (SWITCH_CONFIG.trace) {
+        _hid_stats.snapshot_retries += attempts - 1;
+        if (seq - _taken_seq > 1) {
+            _hid_stats.snapshots_replaced += seq - _taken_seq - 1;
+        }
     }
+    _taken_seq = seq;
 }
 
+void SwitchBluetooth::trace_queued(const Timeline::Event &event, uint32_t now_us) {
+    int32_t wait = (int32_t)(now_us - event.ready_us);
+    _latency[LATENCY_QUEUE].record(wait > 0 ? wait : 0);
 
+    if (!_frame_traced) {
+        _frame_traced = true;
+        _frame_origin_us = event.origin_us;
+        _frame_queued_us = now_us;
+    } else if ((int32_t)(event.origin_us - _frame_origin_us) < 0) {
+        _frame_origin_us = event.origin_us;
+    }
+}
 
 // Implementation of SwitchCommon methods
-void SwitchBluetooth::setSwitchRequestReport(uint8_t *report, int report_size) {
-  memcpy(_switchRequestReport, report, report_size);
+bool SwitchBluetooth::queue_subcommand(uint16_t report_id, const uint8_t *report, int report_size) {
+  // Only 0x01 output reports carry a subcommand; 0x10 is rumble alone
+  if (report_id != 0x01 || report_size <= 10) {
+    return false;
+  }
+  if ((uint8_t)(_request_tail - _request_head) == REQUEST_QUEUE_SIZE) {
+    FastLogger::log_event<LOG_SUBCOMMAND_QUEUE_FULL>();
+    return false;
+  }
+
+  SubcommandRequest &request = _requests[_request_tail & (REQUEST_QUEUE_SIZE - 1)];
+  request.id = report[10];
+  int args = report_size - 11;
+  if (args > SUBCOMMAND_ARGS) {
+    args = SUBCOMMAND_ARGS;
+  }
+  memcpy(request.args, report + 11, args);
+  memset(request.args + args, 0x00, SUBCOMMAND_ARGS - args);
+  _request_tail++;
+  return true;
 }
 
+constexpr SwitchBluetooth::SubcommandTable SwitchBluetooth::build_subcommand_table() {
+  SubcommandTable table = {};
+  for (SubcommandHandler &handler : table.handlers) {
+    handler = &SwitchBluetooth::set_unknown_subcommand;
+  }
+  table.handlers[0x01] = &SwitchBluetooth::set_bt;               // BLUETOOTH_PAIR_REQUEST
+  table.handlers[0x02] = &SwitchBluetooth::set_device_info;      // REQUEST_DEVICE_INFO
+  table.handlers[0x03] = &SwitchBluetooth::set_mode;             // SET_MODE
+  table.handlers[0x04] = &SwitchBluetooth::set_trigger_buttons;  // TRIGGER_BUTTONS
+  table.handlers[0x08] = &SwitchBluetooth::set_shipment;         // SET_SHIPMENT
+  table.handlers[0x10] = &SwitchBluetooth::spi_read;             // SPI_READ
+  table.handlers[0x21] = &SwitchBluetooth::set_nfc_ir_config;    // SET_NFC_IR_CONFIG
+  table.handlers[0x22] = &SwitchBluetooth::set_nfc_ir_state;     // SET_NFC_IR_STATE
+  table.handlers[0x30] = &SwitchBluetooth::set_player_lights;    // SET_PLAYER
+  table.handlers[0x40] = &SwitchBluetooth::toggle_imu;           // TOGGLE_IMU
+  table.handlers[0x41] = &SwitchBluetooth::imu_sensitivity;      // IMU_SENSITIVITY
+  table.handlers[0x48] = &SwitchBluetooth::enable_vibration;     // ENABLE_VIBRATION
+  return table;
+}
+
+const SwitchBluetooth::SubcommandTable SwitchBluetooth::SUBCOMMAND_TABLE = build_subcommand_table();
+
 uint8_t *SwitchBluetooth::generate_report() {
-  set_empty_report();
-  _report[0] = 0xa1;
-  switch (_switchRequestReport[10]) {
-    case 0x01:  // BLUETOOTH_PAIR_REQUEST
-      set_subcommand_reply();
-      set_bt();
-      break;
-    case 0x02:  // REQUEST_DEVICE_INFO
-      _device_info_queried = true;
-      set_subcommand_reply();
-      set_device_info();
-      break;
-    case 0x08:  // SET_SHIPMENT
-      set_subcommand_reply();
-      set_shipment();
-      break;
-    case 0x10:  // SPI_READ
-      set_subcommand_reply();
-      spi_read();
-      break;
-    case 0x03:  // SET_MODE
-      set_subcommand_reply();
-      set_mode();
-      break;
-    case 0x04:  // TRIGGER_BUTTONS
-      set_subcommand_reply();
-      set_trigger_buttons();
-      break;
-    case 0x40:  // TOGGLE_IMU
-      set_subcommand_reply();
-      toggle_imu();
-      break;
-    case 0x41:  // IMU_SENSITIVITY
-      set_subcommand_reply();
-      imu_sensitivity();
-      break;
-    case 0x48:  // ENABLE_VIBRATION
-      set_subcommand_reply();
-      enable_vibration();
-      break;
-    case 0x30:  // SET_PLAYER
-      set_subcommand_reply();
-      set_player_lights();
-      break;
-    case 0x22:  // SET_NFC_IR_STATE
-      set_subcommand_reply();
-      set_nfc_ir_state();
-      break;
-    case 0x21:  // SET_NFC_IR_CONFIG
-      set_subcommand_reply();
-      set_nfc_ir_config();
-      break;
-    default:
-      set_full_input_report();
-      break;
+  _report = _report_buffers[_back_buffer];
+  take_snapshot();
+
+  // Answer the oldest pending subcommand, otherwise send the input state
+  if (_request_head != _request_tail) {
+    const SubcommandRequest &request = _requests[_request_head & (REQUEST_QUEUE_SIZE - 1)];
+    FastLogger::log_event<LOG_SUBCOMMAND>(request.id);
+    set_subcommand_reply();
+    (this->*SUBCOMMAND_TABLE.handlers[request.id])(request);
+    _request_head++;
+  } else {
+    set_full_input_report();
   }
+
+  // The finished buffer goes out; the next frame builds into the other one
+  _back_buffer ^= 1;
   return _report;
 }
 
-void SwitchBluetooth::set_empty_report() {
-  memset(_report, 0x00, sizeof(_report));
+// Persistent report templates; only timer, state, vibration and IMU bytes
+// are patched in each frame
+struct ReportTemplate {
+  uint8_t bytes[SwitchBluetooth::HID_REPORT_SIZE];
+};
+
+static constexpr ReportTemplate build_report_template(uint8_t report_id) {
+  ReportTemplate t = {};
+  t.bytes[0] = 0xa1;
+  t.bytes[1] = report_id;
+  return t;
 }
 
-void SwitchBluetooth::set_empty_switch_request_report() {
-  memset(_switchRequestReport, 0x00, sizeof(_switchRequestReport));
+static constexpr ReportTemplate INPUT_TEMPLATE = build_report_template(0x30);
+static constexpr ReportTemplate REPLY_TEMPLATE = build_report_template(0x21);
+
+void SwitchBluetooth::begin_report(ReportKind kind) {
+  // Input reports reuse whatever the buffer already holds when it is the same
+  // kind; replies always start clean because each writes a different body
+  if (kind == _report_kind[_back_buffer] && kind != REPORT_REPLY) {
+    return;
+  }
+
+  const ReportTemplate &t = kind == REPORT_REPLY ? REPLY_TEMPLATE : INPUT_TEMPLATE;
+  memcpy(_report, t.bytes, sizeof(t.bytes));
+  _report_kind[_back_buffer] = kind;
 }
 
 void SwitchBluetooth::set_subcommand_reply() {
-  // Input Report ID
-  _report[1] = 0x21;
+  // Input Report ID 0x21
+  begin_report(REPORT_REPLY);
 
   // TODO: Find out what the vibrator byte is doing.
   if (_vibration_enabled) {
@@ -422,27 +504,41 @@ void SwitchBluetooth::set_timer() {
 }
 
 void SwitchBluetooth::set_full_input_report() {
-  // Setting Report ID to full standard input report ID
-  _report[1] = 0x30;
+  // Full standard input report ID 0x30, with the next three streamed IMU
+  // samples in builds with IMU support
+  bool imu = SWITCH_CONFIG.imu && _imu_enabled;
+  begin_report(imu ? REPORT_INPUT_IMU : REPORT_INPUT);
+
+  if (_first_report_pending) {
+    _first_report_pending = false;
+    _first_report_ms = (time_us_32() - _link_down_us) / 1000;
+    BootProfile::mark(BootProfile::FIRST_REPORT);
+    FastLogger::log_event<LOG_FIRST_REPORT>(_connect_ms, _first_report_ms);
+  }
 
   set_standard_input_report();
-  set_imu_data();
+  if (imu) {
+    _imu_stream.pop_frame(_report + 14);
+  }
 }
 
 void SwitchBluetooth::set_standard_input_report() {
   set_timer();
 
-  memcpy(_report + 3, (uint8_t *)&_switchReport, sizeof(SwitchReport));
+  memcpy(_report + 3, (uint8_t *)&_taken.report, sizeof(SwitchReport));
   _report[13] = _vibration_report;
 }
 
-void SwitchBluetooth::set_bt() {
+void SwitchBluetooth::set_bt(const SubcommandRequest &) {
   _report[14] = 0x81;
   _report[15] = 0x01;
   _report[16] = 0x03;
 }
 
-void SwitchBluetooth::set_device_info() {
+void SwitchBluetooth::set_device_info(const SubcommandRequest &) {
+  _device_info_queried = true;
+  BootProfile::mark(BootProfile::DEVICE_INFO);
+
   // ACK Reply
   _report[14] = 0x82;
   // Subcommand Reply
@@ -462,92 +558,56 @@ void SwitchBluetooth::set_device_info() {
   _report[27] = 0x01;
 }
 
-void SwitchBluetooth::set_shipment() {
+void SwitchBluetooth::set_shipment(const SubcommandRequest &) {
   _report[14] = 0x80;
   _report[15] = 0x08;
 }
 
-void SwitchBluetooth::toggle_imu() {
-  _imu_enabled = _switchRequestReport[11] == 0x01;
+void SwitchBluetooth::toggle_imu(const SubcommandRequest &request) {
+  _imu_enabled = request.args[0] == 0x01;
   _report[14] = 0x80;
   _report[15] = 0x40;
 }
 
-void SwitchBluetooth::imu_sensitivity() {
+void SwitchBluetooth::imu_sensitivity(const SubcommandRequest &) {
   _report[14] = 0x80;
   _report[15] = 0x41;
 }
 
-void SwitchBluetooth::set_imu_data() {
-  if (!_imu_enabled) {
-    return;
+void SwitchBluetooth::spi_read(const SubcommandRequest &request) {
+  uint32_t address = request.args[0] | (request.args[1] << 8) | (request.args[2] << 16) |
+                     ((uint32_t)request.args[3] << 24);
+  uint8_t read_length = request.args[4];
+  if (read_length > SpiImage::MAX_READ) {
+    read_length = SpiImage::MAX_READ;
   }
 
-  uint8_t imu_data[49] = {0x75, 0xFD, 0xFD, 0xFF, 0x09, 0x10, 0x21, 0x00, 0xD5,
-                          0xFF, 0xE0, 0xFF, 0x72, 0xFD, 0xF9, 0xFF, 0x0A, 0x10,
-                          0x22, 0x00, 0xD5, 0xFF, 0xE0, 0xFF, 0x76, 0xFD, 0xFC,
-                          0xFF, 0x09, 0x10, 0x23, 0x00, 0xD5, 0xFF, 0xE0, 0xFF};
-  memcpy(_report + 14, imu_data, sizeof(imu_data));
-}
-
-void SwitchBluetooth::spi_read() {
-  uint8_t addr_top = _switchRequestReport[12];
-  uint8_t addr_bottom = _switchRequestReport[11];
-  uint8_t read_length = _switchRequestReport[15];
-
   _report[14] = 0x90;
   _report[15] = 0x10;
-  _report[16] = addr_bottom;
-  _report[17] = addr_top;
+  memcpy(_report + 16, request.args, 4);
   _report[20] = read_length;
 
-  uint8_t params[18] = {0x0F, 0x30, 0x61, 0x96, 0x30, 0xF3, 0xD4, 0x14, 0x54,
-                        0x41, 0x15, 0x54, 0xC7, 0x79, 0x9C, 0x33, 0x36, 0x63};
-
-  if (addr_top == 0x60 && addr_bottom == 0x00) {
-    memset(_report + 21, 0xff, 16);
-  } else if (addr_top == 0x60 && addr_bottom == 0x50) {
-    memset(_report + 21, 0x32, 3);
-    memset(_report + 24, 0xff, 3);
-    memset(_report + 27, 0xff, 7);
-  } else if (addr_top == 0x60 && addr_bottom == 0x80) {
-    _report[21] = 0x50; _report[22] = 0xFD; _report[23] = 0x00;
-    _report[24] = 0x00; _report[25] = 0xC6; _report[26] = 0x0F;
-    memcpy(_report + 27, params, sizeof(params));
-  } else if (addr_top == 0x60 && addr_bottom == 0x98) {
-    memcpy(_report + 21, params, sizeof(params));
-  } else if (addr_top == 0x80 && addr_bottom == 0x10) {
-    memset(_report + 21, 0xff, 3);
-  } else if (addr_top == 0x60 && addr_bottom == 0x3D) {
-    uint8_t l_calibration[9] = {0xD4, 0x75, 0x61, 0xE5, 0x87, 0x7C, 0xEC, 0x55, 0x61};
-    uint8_t r_calibration[9] = {0x5D, 0xD8, 0x7F, 0x18, 0xE6, 0x61, 0x86, 0x65, 0x5D};
-    memcpy(_report + 21, l_calibration, sizeof(l_calibration));
-    memcpy(_report + 30, r_calibration, sizeof(r_calibration));
-    _report[39] = 0xFF;
-    memset(_report + 40, 0x32, 3);
-    memset(_report + 43, 0xff, 3);
-  } else if (addr_top == 0x60 && addr_bottom == 0x20) {
-    uint8_t sa_calibration[24] = {0xcc, 0x00, 0x40, 0x00, 0x91, 0x01,
-                                  0x00, 0x40, 0x00, 0x40, 0x00, 0x40,
-                                  0xe7, 0xff, 0x0e, 0x00, 0xdc, 0xff,
-                                  0x3b, 0x34, 0x3b, 0x34, 0x3b, 0x34};
-    memcpy(_report + 21, sa_calibration, sizeof(sa_calibration));
-  } else {
-    memset(_report + 21, 0xFF, read_length);
-  }
+  _spi_image.read(address, _report + 21, read_length);
 }
 
-void SwitchBluetooth::set_mode() {
+// Subcommands without a reply of their own are acknowledged so the console
+// doesn't time out and retry
+void SwitchBluetooth::set_unknown_subcommand(const SubcommandRequest &request) {
+  _report[14] = 0x80;
+  _report[15] = request.id;
+}
+
+void SwitchBluetooth::set_mode(const SubcommandRequest &) {
   _report[14] = 0x80;
   _report[15] = 0x03;
 }
 
-void SwitchBluetooth::set_trigger_buttons() {
+void SwitchBluetooth::set_trigger_buttons(const SubcommandRequest &) {
   _report[14] = 0x83;
   _report[15] = 0x04;
 }
 
-void SwitchBluetooth::enable_vibration() {
+void SwitchBluetooth::enable_vibration(const SubcommandRequest &) {
   _report[14] = 0x80;
   _report[15] = 0x48;
   _vibration_enabled = true;
@@ -556,11 +616,11 @@ void SwitchBluetooth::enable_vibration() {
   _vibration_report = VIB_OPTS[_vibration_idx];
 }
 
-void SwitchBluetooth::set_player_lights() {
+void SwitchBluetooth::set_player_lights(const SubcommandRequest &request) {
   _report[14] = 0x80;
   _report[15] = 0x30;
 
-  uint8_t bitfield = _switchRequestReport[11];
+  uint8_t bitfield = request.args[0];
   if (bitfield == 0x01 || bitfield == 0x10) {
     _player_number = 1;
   } else if (bitfield == 0x03 || bitfield == 0x30) {
@@ -572,12 +632,12 @@ void SwitchBluetooth::set_player_lights() {
   }
 }
 
-void SwitchBluetooth::set_nfc_ir_state() {
+void SwitchBluetooth::set_nfc_ir_state(const SubcommandRequest &) {
   _report[14] = 0x80;
   _report[15] = 0x22;
 }
 
-void SwitchBluetooth::set_nfc_ir_config() {
+void SwitchBluetooth::set_nfc_ir_config(const SubcommandRequest &) {
   _report[14] = 0xA0;
   _report[15] = 0x21;
   uint8_t params[8] = {0x01, 0x00, 0xFF, 0x00, 0x08, 0x00, 0x1B, 0x01};
@@ -585,14 +645,29 @@ void SwitchBluetooth::set_nfc_ir_config() {
   _report[49] = 0xC8;
 }
 
-void SwitchBluetooth::set_controller_rumble(bool rumble) {
-  // No physical rumble to set in our case
+// Rumble data follows the packet counter in both 0x01 and 0x10 output reports
+void SwitchBluetooth::decode_rumble(uint16_t report_id, const uint8_t *report, int report_size) {
+  if ((report_id != 0x01 && report_id != 0x10) || report_size < 2 + RumbleDecoder::DATA_SIZE) {
+    return;
+  }
+  _rumble.update(report + 2, time_us_32());
 }
 
 void packet_handler(SwitchBluetooth *inst, uint8_t packet_type, uint8_t *packet) {
-  if (packet_type != HCI_EVENT_PACKET || packet[0] != HCI_EVENT_HID_META) {
+  if (packet_type != HCI_EVENT_PACKET) {
     return; // Fast exit for irrelevant packets
   }
+  if (packet[0] == BTSTACK_EVENT_STATE) {
+    // The radio is up: go straight back to a known console
+    if (btstack_event_state_get_state(packet) == HCI_STATE_WORKING) {
+      BootProfile::mark(BootProfile::DISCOVERABLE);
+      inst->reconnect();
+    }
+    return;
+  }
+  if (packet[0] != HCI_EVENT_HID_META) {
+    return;
+  }
   
   uint8_t subevent = hci_event_hid_meta_get_subevent_code(packet);
   
@@ -601,10 +676,14 @@ void packet_handler(SwitchBluetooth *inst, uint8_t packet_type, uint8_t *packet)
       {
         uint8_t status = hid_subevent_connection_opened_get_status(packet);
         if (status) {
-          FastLogger::log("Connection failed");
+          FastLogger::log_event<LOG_CONNECTION_FAILED>();
           inst->setHidCid(0);
         } else {
-          FastLogger::log("Switch connected - ready for commands");
+          FastLogger::log_event<LOG_SWITCH_CONNECTED>();
+          BootProfile::mark(BootProfile::CONNECTED);
+          bd_addr_t console;
+          hid_subevent_connection_opened_get_bd_addr(packet, console);
+          inst->remember_console(console);
           inst->setHidCid(hid_subevent_connection_opened_get_hid_cid(packet));
           hid_device_request_can_send_now_event(inst->getHidCid());
         }
@@ -612,21 +691,21 @@ void packet_handler(SwitchBluetooth *inst, uint8_t packet_type, uint8_t *packet)
       break;
       
     case HID_SUBEVENT_CONNECTION_CLOSED:
-      FastLogger::log("Switch disconnected");
+      FastLogger::log_event<LOG_SWITCH_DISCONNECTED>();
       inst->setHidCid(0);
       break;
       
     case HID_SUBEVENT_CAN_SEND_NOW:
       {
         try {
-          // Process any remaining queued commands before generating report
-          inst->process_command_queue();
-          
+          inst->mark_can_send();
+
+          // The latest published input state goes out as is; due events
+          // are moved into it on the producer side
           uint8_t *report = inst->generate_report();
-          hid_device_send_interrupt_message(inst->getHidCid(), report, 50);
-          inst->set_empty_switch_request_report();
+          hid_device_send_interrupt_message(inst->getHidCid(), report, SwitchBluetooth::HID_REPORT_SIZE);
           
-          // Mark report as sent for timing control (applies to all reports)
+          // Cadence and latency telemetry (applies to all reports)
           inst->mark_report_sent();
           
           hid_device_request_can_send_now_event(inst->getHidCid());
@@ -643,6 +722,9 @@ void packet_handler(SwitchBluetooth *inst, uint8_t packet_type, uint8_t *packet)
 }
 
 void hid_report_data_callback(SwitchBluetooth *inst, uint16_t report_id, uint8_t *report, int report_size) {
-  // Skip rumble processing for performance - not needed for macro execution
-  inst->setSwitchRequestReport(report, report_size);
+  // Subcommands are queued for a reply; rumble changes are passed on to the host
+  if constexpr (SWITCH_CONFIG.rumble) {
+    inst->decode_rumble(report_id, report, report_size);
+  }
+  inst->queue_subcommand(report_id, report, report_size);
 }
\ No newline at end of file
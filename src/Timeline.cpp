@@ -0,0 +1,91 @@
+#include "Timeline.h"
+#include "hardware/sync.h"
+#include "pico/stdlib.h"
+
+void Timeline::reset() {
+    _head = 0;
+    _tail = 0;
+    _cursor_us = 0;
+    _cancel_requests = 0;
+    _cancel_tail = 0;
+    _cancel_handled = 0;
+}
+
+bool Timeline::schedule(const InputOp& op, uint8_t after_frames) {
+    if (free_slots() == 0) {
+        return false;
+    }
+
+    // Commands reaching an idle schedule start a new step at the current time;
+    // while earlier events are still queued they share the cursor and coalesce
+    if (is_empty()) {
+        uint64_t now = time_us_64();
+        if (_cursor_us < now) {
+            _cursor_us = now;
+        }
+    }
+
+    Event& event = _events[_tail & (CAPACITY - 1)];
+    event.op = op;
+    event.due_us = _cursor_us;
+    event.after_frames = after_frames;
+    if constexpr (SWITCH_CONFIG.trace) {
+        uint32_t now = time_us_32();
+        int32_t delay = (int32_t)((uint32_t)_cursor_us - now);
+        if (delay < 0) {
+            delay = 0;
+        }
+        event.ready_us = now + delay;
+        event.origin_us = _received_us + delay;
+    }
+
+    // Publish the event before the consumer can see the new tail
+    __dmb();
+    _tail = _tail + 1;
+    return true;
+}
+
+void Timeline::delay(uint32_t duration_us) {
+    // An idle schedule restarts from now rather than from the last event
+    uint64_t now = time_us_64();
+    if (_cursor_us < now) {
+        _cursor_us = now;
+    }
+    _cursor_us += duration_us;
+}
+
+// Drop everything scheduled so far; the consumer skips it on its next peek
+void Timeline::cancel() {
+    _cancel_tail = _tail;
+    __dmb();
+    _cancel_requests = _cancel_requests + 1;
+    _cursor_us = 0;
+}
+
+const Timeline::Event* Timeline::peek_due(uint64_t now_us) {
+    if (_cancel_handled != _cancel_requests) {
+        _cancel_handled = _cancel_requests;
+        __dmb();
+        if ((int32_t)(_cancel_tail - _head) > 0) {
+            _head = _cancel_tail;
+        }
+    }
+
+    if (is_empty()) {
+        return nullptr;
+    }
+
+    // Events are pushed in schedule order, so only the head needs checking
+    __dmb();
+    const Event& next = _events[_head & (CAPACITY - 1)];
+    if (next.due_us > now_us) {
+        return nullptr;
+    }
+    return &next;
+}
+
+void Timeline::pop() {
+    // Finish reading the slot before handing it back to the producer
+    __dmb();
+    _head = _head + 1;
+}
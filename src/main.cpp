@@ -2,16 +2,27 @@
 #include <string.h>
 
 #include "SwitchBluetooth.h"
+#include "BootProfile.h"
 #include "CommandParser.h"
 #include "FastLogger.h"
+#include "MacroStore.h"
+#include "SerialInput.h"
+#include "pico/flash.h"
 #include "pico/stdlib.h"
 #include "btstack.h"
 
+#if SWITCH_DUAL_CORE
+#include "pico/multicore.h"
+#endif
+
 SwitchBluetooth *switchController = nullptr;
 CommandParser *commandParser = nullptr;
+MacroStore *macroStore = nullptr;
 
 static btstack_packet_callback_registration_t hci_event_callback_registration;
+#if !SWITCH_DUAL_CORE
 static btstack_timer_source_t serial_timer;
+#endif
 
 static void packet_handler_wrapper(uint8_t packet_type, uint16_t channel,
                                    uint8_t *packet, uint16_t packet_size) {
@@ -29,50 +40,72 @@ static void hid_report_data_callback_wrapper(uint16_t cid,
 }
 
 void process_serial_commands() {
-    static char line_buffer[128]; // Reduced buffer size
-    static int buffer_pos = 0;
-    
-    // Update non-blocking sleep state
-    commandParser->update_sleep_state();
+    // Drain the CDC FIFO in bulk, then run every line that came with it
+    SerialInput::receive();
     
-    // Skip command processing if we're in a sleep state
-    if (commandParser->is_sleeping()) {
-        return;
+    while (true) {
+        // Macro uploads are raw binary chunks rather than command lines
+        if (macroStore->is_receiving()) {
+            uint8_t byte;
+            if (!SerialInput::read_byte(byte)) {
+                break;
+            }
+            macroStore->receive(byte);
+            continue;
+        }
+        
+        // Leave lines buffered until the timeline can take another one; once
+        // the ring fills, the rest waits in the USB stack
+        if (switchController->timeline().free_slots() < CommandParser::MAX_EVENTS_PER_LINE) {
+            break;
+        }
+        
+        uint32_t received_us;  // First byte of the line, for latency stats
+        uint32_t dropped;
+        const char *line = SerialInput::next_line(received_us, dropped);
+        for (; dropped > 0; dropped--) {
+            commandParser->reject_line(CommandParser::ERROR_LINE_TOO_LONG);
+        }
+        if (!line) {
+            break;
+        }
+        commandParser->parse_and_execute(line, received_us);
     }
+}
+
+#if SWITCH_DUAL_CORE
+// Core 1 owns USB ingestion, parsing, timeline playback and log output.
+// Each frame's input state reaches core 0 as a published snapshot, so
+// serial bursts never delay HID reports and the radio never stalls
+// ingestion.
+static void core1_entry() {
+    // Lets core 0 lock this core out while BTstack writes link keys and
+    // TLV entries to flash
+    flash_safe_execute_core_init();
     
-    // Process multiple characters per call to reduce overhead
-    for (int i = 0; i < 16; i++) { // Process up to 16 chars at once
-        int c = getchar_timeout_us(0); // Non-blocking read
-        if (c == PICO_ERROR_TIMEOUT) {
-            break; // No more data available
-        }
+    while (true) {
+        process_serial_commands();
+        macroStore->poll();
+        switchController->play_due_events();
         
-        if (c == '\n' || c == '\r') {
-            if (buffer_pos > 0) {
-                line_buffer[buffer_pos] = '\0';
-                
-                // Execute command - timing is now handled in SwitchBluetooth
-                commandParser->parse_and_execute(line_buffer);
-                
-                buffer_pos = 0;
-            }
-        } else if (buffer_pos < sizeof(line_buffer) - 1) {
-            line_buffer[buffer_pos++] = c;
-        } else {
-            // Buffer overflow - reset silently
-            buffer_pos = 0;
+        if (FastLogger::has_pending_logs()) {
+            FastLogger::flush_logs();
         }
+        
+        tight_loop_contents();
     }
 }
+#endif
 
+#if !SWITCH_DUAL_CORE
+// Single-core builds share core 0 with BTstack, so ingestion runs from its
+// run loop instead
 static void serial_timer_handler(btstack_timer_source_t *ts) {
-    // Process serial commands with minimal latency
+    // Process serial commands with minimal latency, then build the next
+    // frame so the HID send path only has to pick it up
     process_serial_commands();
-    
-    // Process any remaining queued commands for reliability
-    if (switchController && switchController->has_queued_commands()) {
-        switchController->process_command_queue();
-    }
+    macroStore->poll();
+    switchController->play_due_events();
     
     // Flush logs non-blocking way (only when there's time)
     if (FastLogger::has_pending_logs()) {
@@ -83,49 +116,82 @@ static void serial_timer_handler(btstack_timer_source_t *ts) {
     btstack_run_loop_set_timer(ts, 1);  // 1ms intervals for ultra-fast command processing
     btstack_run_loop_add_timer(ts);
 }
+#endif
 
 int main() {
-  // Initialize stdio USB for serial communication
-  stdio_init_all();
+  BootProfile::mark(BootProfile::MAIN);
   
-  // Initialize fast logging system
+  // Log records queue up until USB is running
   FastLogger::init();
-  
-  // Non-blocking initialization - remove delays that interfere with command processing
-  // USB will initialize in background while we start Bluetooth stack
-  FastLogger::log("Autoshine Pico Firmware Starting...");
+  FastLogger::log<LOG_HID, LOG_INFO>("Autoshine Pico Firmware Starting...");
   
   // Initialize Switch controller
   switchController = new SwitchBluetooth();
-  commandParser = new CommandParser(switchController);
+  macroStore = new MacroStore();
+  commandParser = new CommandParser(switchController, macroStore);
   
+  // The radio is the slowest part of boot, so it goes first: once powered
+  // on, the HCI init sequence runs in the background while USB and the
+  // macro store come up
   switchController->init();
   
-  FastLogger::log("Bluetooth controller initialized");
-  
   hci_event_callback_registration.callback = &packet_handler_wrapper;
   hci_add_event_handler(&hci_event_callback_registration);
 
   hid_device_register_packet_handler(&packet_handler_wrapper);
   hid_device_register_report_data_callback(&hid_report_data_callback_wrapper);
 
+  // turn on!
+  hci_power_control(HCI_POWER_ON);
+  BootProfile::mark(BootProfile::POWER_ON);
+  
+  // Initialize stdio USB for serial communication; enumeration finishes
+  // in the background
+  stdio_init_all();
+  BootProfile::mark(BootProfile::USB_READY);
+  
+  macroStore->init();
+  BootProfile::mark(BootProfile::STORE_READY);
+  
+  FastLogger::log<LOG_HID, LOG_INFO>("Bluetooth controller initialized");
+
+#if SWITCH_DUAL_CORE
+  // Lets core 1 lock core 0 out while it writes the macro store
+  flash_safe_execute_core_init();
+  multicore_launch_core1(core1_entry);
+  FastLogger::log<LOG_PARSER, LOG_INFO>("Serial ingestion running on core 1");
+#else
   // Set up periodic timer for serial command processing - ultra-fast 1ms intervals
   serial_timer.process = &serial_timer_handler;
   btstack_run_loop_set_timer(&serial_timer, 1);  // Start after 1ms 
   btstack_run_loop_add_timer(&serial_timer);
-
-  // turn on!
-  hci_power_control(HCI_POWER_ON);
+#endif
   
-  FastLogger::log("Bluetooth stack started. Waiting for commands over USB serial...");
-  FastLogger::log("Available commands:");
-  FastLogger::log("  PRESS <button>      - Press and release a button");
-  FastLogger::log("  HOLD <button>       - Hold a button down (without releasing)");
-  FastLogger::log("  RELEASE <button>    - Release a button");  
-  FastLogger::log("  STICK <stick> <h> <v> - Set stick position (-1.0 to 1.0)");
-  FastLogger::log("  SLEEP <seconds>     - Sleep for specified duration");
-  FastLogger::log("  # comment           - Comment line (ignored)");
-  FastLogger::log("Ready for commands...");
+  FastLogger::log<LOG_HID, LOG_INFO>("Bluetooth stack started. Waiting for commands over USB serial...");
+
+  // Command help, left out of builds that keep only replies and errors
+  if constexpr (log_enabled(LOG_PARSER, LOG_INFO)) {
+    FastLogger::log("Available commands:");
+    FastLogger::log("  PRESS <button> [n]f - Press for n frames (default 3), then release");
+    FastLogger::log("  HOLD <button>       - Hold a button down (without releasing)");
+    FastLogger::log("  RELEASE <button>    - Release a button");
+    FastLogger::log("  STICK <stick> <h> <v> - Set stick position (-1.0 to 1.0)");
+    FastLogger::log("  STICK_RAMP <stick> <h> <v> <frames> - Ramp the stick to a position");
+    FastLogger::log("  STICK_CIRCLE <stick> <radius> <frames> [CW] - Circle, one turn per period");
+    FastLogger::log("  STICK_OSC <stick> <h> <v> <frames> - Oscillate around the centre");
+    FastLogger::log("  SLEEP <seconds>     - Sleep for specified duration");
+    FastLogger::log("  IMU <hex>           - Queue 12-byte accel/gyro samples for motion controls");
+    FastLogger::log("  UPLOAD <slot> <len> - Store a macro in flash (binary chunks follow)");
+    FastLogger::log("  RUN <slot> [count]  - Play a stored macro (count 0 = forever)");
+    FastLogger::log("  STOP                - Stop playback and release everything");
+    FastLogger::log("  SPIWRITE <addr> <hex> - Override SPI flash bytes read by the console");
+    FastLogger::log("  STATS [RESET]       - Show or clear input latency statistics");
+    FastLogger::log("  BOOTSTATS           - Show boot and first connection timestamps");
+    FastLogger::log("  LIST                - List stored macros");
+    FastLogger::log("  ERASE ALL           - Erase all stored macros");
+    FastLogger::log("  # comment           - Comment line (ignored)");
+    FastLogger::log("Ready for commands...");
+  }
 
   // Enter BTStack main event loop (this blocks)
   btstack_run_loop_execute();